@@ -70,6 +70,17 @@ float Camera::depthOfPoint(glm::vec3 position)
 	return -viewZ; // positive distance
 }
 
+void Camera::screenRay(glm::vec2 screenPos, uint32_t width, uint32_t height, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::vec2 ndc = screenPos / glm::vec2(width, height) * 2.0f - 1.0f;
+	glm::mat4 invViewProj = glm::inverse(proj * view);
+
+	glm::vec4 nearPoint = invViewProj * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec4 farPoint = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
 void Camera::toggleViewMode()
 {
 	this->viewMode = (viewMode == ViewMode::PERSPECTIVE) ? ViewMode::ORTHOGONAL : ViewMode::PERSPECTIVE;
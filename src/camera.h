@@ -52,6 +52,9 @@ struct Camera {
 
 	float depthOfPoint(glm::vec3 position);
 
+	// World space ray through a point on the screen, the inverse of projectPositionToScreen
+	void screenRay(glm::vec2 screenPos, uint32_t width, uint32_t height, glm::vec3& origin, glm::vec3& direction);
+
 	void toggleViewMode();
 
 	void onMouseButton(GLFWwindow* window, int button, int action, int mods);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 namespace osp {
@@ -13,6 +16,15 @@ static void setColumn(glm::mat4& mat, glm::vec3 colVec, size_t index)
 	mat[index][2] = colVec[2];
 }
 
+// The first segment ending at or after s, as getSegmentAtLength(), walking there from seg. Quick when s is
+// close to the s seg was found for.
+static size_t walkToSegment(const std::vector<float>& cumulativeLengths, float s, size_t seg)
+{
+	while (seg > 0 && cumulativeLengths[seg - 1] >= s) seg--;
+	while (seg + 1 < cumulativeLengths.size() && cumulativeLengths[seg] < s) seg++;
+	return seg;
+}
+
 struct ICurve {
 	virtual ~ICurve() = default;
 
@@ -35,9 +47,22 @@ struct ICurve {
 	virtual glm::mat4 evaluateFrenet(float s, const std::vector<float>& roll) = 0;
 	virtual size_t getSegmentAtLength(float s) = 0;
 	virtual glm::vec3 getTangentAtLength(float s) = 0;
+	// Tangents at several arc lengths in one call, e.g. for all samples of the slope table. Curves override
+	// it to find the segment of each s from the one before, which is quick for sorted s.
+	virtual void getTangentsAtLengths(const float* s, glm::vec3* tangents, size_t count)
+	{
+		for (size_t i = 0; i < count; i++) {
+			tangents[i] = getTangentAtLength(s[i]);
+		}
+	}
 	virtual float totalLength() const = 0;
+	virtual size_t getNumSegments() const = 0;
+	virtual float getSegmentEndLength(size_t i) const = 0;
 	virtual void update() = 0;
 
+	// Deep copy, used to hand a snapshot of the track to another thread
+	virtual std::unique_ptr<ICurve> clone() const = 0;
+
 	virtual float normalizedToArcLength(float u) = 0;
 	virtual float arcLengthToNormalized(float s) = 0;
 	virtual float normalizedInSegment(float s) = 0;
@@ -47,6 +72,7 @@ struct ICurve {
 	virtual size_t getNumControlPoints() = 0;
 	virtual void setControlPoint(size_t i, glm::vec3 value) = 0;
 	virtual void appendControlPoint(glm::vec3 value) = 0;
+	virtual void insertControlPoint(size_t i, glm::vec3 value) = 0; // before the current point i
 	virtual void extendBack() = 0;
 	virtual void removeBack() = 0;
 
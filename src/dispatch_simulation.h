@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <vector>
+
+#include "parallel_for.h"
+#include "slope_table.h"
+#include "track.h"
+#include "track_zones.h"
+#include "train_integrator.h"
+
+namespace osp
+{
+
+// Several trains on the track as a circuit, for the hourly capacity of the ride. The station is at s = 0
+// and the end of the track leads back into it. Block brake zones split the track into blocks, a brake only
+// lets a train into the next block once no other train is in it, and a closed brake stops and holds the
+// train until then. Trains dwell in the station to unload and load and are dispatched when the first
+// block is clear, trains arriving while the station is taken stack up at the end of the track.
+// Moving trains advance in fixed steps on the track's SlopeTable and zones, shared by all of them, with
+// their state kept per field over all trains. When every train stands still the clock jumps straight to
+// the next dwell or dispatch, so runs go many times faster than real time, and runBatch() spreads
+// independent runs over all cores.
+class DispatchSimulation
+{
+public:
+	struct Settings {
+		uint32_t trainCount = 2;
+		float    dwell = 30.0f;           // seconds in the station per train
+		float    minimumInterval = 0.0f;  // seconds between dispatches
+		uint32_t seatsPerCar = 4;
+		float    releaseSpeed = 2.0f;     // m/s the tires of the station and of open block brakes push trains to
+		double   duration = 3600.0;       // simulated seconds
+		double   step = 0.005;            // seconds, while a train moves
+		TrainIntegrator::Parameters physics; // train, friction and drag
+	};
+
+	// A section between two block brakes, block 0 starts at the station
+	struct Block {
+		float    start = 0.0f;
+		float    end = 0.0f;
+		double   occupiedSeconds = 0.0;
+		uint32_t stops = 0;          // trains stopped at its brake because the next block was occupied
+		double   stoppedSeconds = 0.0;
+		uint32_t overruns = 0;       // trains too fast to stop, they went on into the occupied block
+	};
+
+	struct Report {
+		uint32_t dispatches = 0;
+		uint32_t circuits = 0;       // trains back in the station
+		double   ridersPerHour = 0.0;
+		double   stationSeconds = 0.0;  // a train dwelling in the station
+		double   dispatchDelay = 0.0;   // train seconds loaded in the station, waiting for the first block
+		uint32_t stacked = 0;           // trains arriving while the station was taken
+		double   stackedSeconds = 0.0;
+		bool     stuck = false;         // a train stopped outside lifts, launches and brakes, the run ends with no capacity
+		float    stuckS = 0.0f;
+		double   simulatedSeconds = 0.0;
+		double   milliseconds = 0.0;
+		std::vector<Block> blocks;
+
+		double utilization(const Block& block) const
+		{
+			return simulatedSeconds > 0.0 ? block.occupiedSeconds / simulatedSeconds : 0.0;
+		}
+	};
+
+	Settings settings;
+
+	// track has to have its slopes, see Track::update()
+	Report run(const Track& track)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		const SlopeTable& slopes = track.slopes;
+		const TrackZones& zones = track.zones;
+		const float       totalLength = slopes.totalLength;
+		const float       trainLength = settings.physics.train.length();
+
+		Report report;
+		splitBlocks(zones, totalLength, report);
+		std::vector<uint32_t> occupancy(report.blocks.size());
+		std::vector<uint8_t>  closed(report.blocks.size());
+
+		trains = {};
+		trains.resize(std::max(settings.trainCount, 1u));
+		std::deque<uint32_t> queue; // waiting for the station, front first
+		for (uint32_t i = 1; i < trains.size(); i++) {
+			trains.phase[i] = Phase::Parked;
+			queue.push_back(i);
+		}
+		trains.phase[0] = Phase::Loading;
+		trains.timer[0] = settings.dwell;
+
+		const double friction = settings.physics.rollingFriction * 9.81;
+		const double drag = settings.physics.dragCoeff;
+		double time = 0.0;
+		double lastDispatch = -std::numeric_limits<double>::infinity();
+
+		auto blockOf = [&](float s) -> int {
+			if (s < 0.0f) return -1;
+			auto it = std::upper_bound(boundaries.begin(), boundaries.end(), s);
+			return static_cast<int>(it - boundaries.begin()) - 1;
+		};
+		// block brakes that end a block stop trains while the next one is occupied, the others stay open
+		auto isClosed = [&](uint32_t z) {
+			return brakeBlock[z] >= 0 && closed[brakeBlock[z]];
+		};
+		auto stationTaken = [&]() {
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				if (trains.phase[i] == Phase::Loading || trains.phase[i] == Phase::Ready) return true;
+			}
+			return false;
+		};
+		auto enterStation = [&](uint32_t i) {
+			trains.phase[i] = Phase::Loading;
+			trains.s[i] = 0.0f;
+			trains.v[i] = 0.0f;
+			trains.timer[i] = time + settings.dwell;
+			trains.cursor[i] = {};
+		};
+
+		while (time < settings.duration && !report.stuck) {
+			// discrete events: dwell ends, dispatches and the station queue
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				if (trains.phase[i] == Phase::Loading && trains.timer[i] <= time) trains.phase[i] = Phase::Ready;
+			}
+			std::fill(occupancy.begin(), occupancy.end(), 0u);
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				Phase phase = trains.phase[i];
+				if (phase != Phase::Running && phase != Phase::Held) continue;
+				int front = blockOf(trains.s[i]);
+				int rear = blockOf(trains.s[i] - trainLength);
+				for (int b = std::max(rear, 0); b <= front; b++) occupancy[b]++;
+			}
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				if (trains.phase[i] == Phase::Ready && occupancy[0] == 0 && time >= lastDispatch + settings.minimumInterval) {
+					trains.phase[i] = Phase::Running;
+					trains.v[i] = settings.releaseSpeed;
+					lastDispatch = time;
+					report.dispatches++;
+					occupancy[0]++;
+				}
+			}
+			if (!queue.empty() && !stationTaken()) {
+				enterStation(queue.front());
+				queue.pop_front();
+			}
+			for (size_t b = 0; b < closed.size(); b++) {
+				closed[b] = b + 1 < occupancy.size() && occupancy[b + 1] > 0;
+			}
+
+			// without a moving train nothing happens until the next dwell ends or the dispatch interval passes
+			bool   moving = false;
+			double next = settings.duration;
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				Phase phase = trains.phase[i];
+				if (phase == Phase::Running || (phase == Phase::Held && !closed[trains.heldAt[i]])) moving = true;
+				else if (phase == Phase::Loading) next = std::min(next, trains.timer[i]);
+				else if (phase == Phase::Ready && occupancy[0] == 0) next = std::min(next, lastDispatch + settings.minimumInterval);
+			}
+			double dt = moving ? std::min(settings.step, settings.duration - time) : std::max(next - time, 0.0);
+			if (!moving && dt <= 0.0) {
+				// nothing left to wait for
+				dt = settings.duration - time;
+			}
+
+			for (uint32_t i = 0; i < trains.size(); i++) {
+				switch (trains.phase[i]) {
+				case Phase::Loading: report.stationSeconds += dt; break;
+				case Phase::Ready: report.stationSeconds += dt; report.dispatchDelay += dt; break;
+				case Phase::Stacked: report.stackedSeconds += dt; break;
+				case Phase::Held: report.blocks[trains.heldAt[i]].stoppedSeconds += dt; break;
+				default: break;
+				}
+			}
+			for (size_t b = 0; b < occupancy.size(); b++) {
+				if (occupancy[b] > 0) report.blocks[b].occupiedSeconds += dt;
+			}
+
+			// continuous part: the moving trains, semi-implicit Euler
+			for (uint32_t i = 0; moving && i < trains.size(); i++) {
+				Phase& phase = trains.phase[i];
+				if (phase == Phase::Held) {
+					if (closed[trains.heldAt[i]]) continue;
+					phase = Phase::Running;
+				}
+				if (phase != Phase::Running) continue;
+
+				float  s = trains.s[i];
+				double v = trains.v[i];
+				double a = settings.physics.train.gravityAlongTrack(slopes, s);
+				if (v > 0.00001 || v < -0.00001) a -= friction * (v > 0.0 ? 1.0 : -1.0);
+				a -= drag * v * std::abs(v);
+
+				int   brake = -1;
+				float brakeEnd = 0.0f;
+				bool  propelled = false;
+				for (uint32_t z : zones.at(s, trains.cursor[i])) {
+					const TrackZone& zone = zones[z];
+					propelled |= zone.propels();
+					if (zone.type != TrackZone::Type::BlockBrake) {
+						a = zone.accelerate(v, a);
+						continue;
+					}
+					if (isClosed(z)) {
+						brake = brakeBlock[z];
+						brakeEnd = zone.end;
+						TrackZone stopping = zone;
+						stopping.speed = 0.0f;
+						a = stopping.accelerate(v, a);
+					}
+					else if (zone.speed > 0.0f) {
+						a = zone.accelerate(v, a);
+					}
+				}
+
+				v += a * dt;
+				for (uint32_t z : zones.at(s, trains.cursor[i])) {
+					if (zones[z].type != TrackZone::Type::BlockBrake) continue;
+					if (isClosed(z)) v = std::max(v, 0.0);
+					else v = std::max<double>(v, settings.releaseSpeed);
+				}
+				s += static_cast<float>(v * dt);
+
+				if (s >= totalLength) {
+					report.circuits++;
+					if (queue.empty() && !stationTaken()) {
+						enterStation(i);
+					}
+					else {
+						phase = Phase::Stacked;
+						trains.s[i] = totalLength;
+						trains.v[i] = 0.0f;
+						queue.push_back(i);
+						report.stacked++;
+					}
+					continue;
+				}
+				trains.s[i] = std::max(s, 0.0f);
+				trains.v[i] = static_cast<float>(v);
+				if (brake >= 0 && s >= brakeEnd) {
+					report.blocks[brake].overruns++;
+				}
+
+				if (v <= 0.0 && brake >= 0) {
+					phase = Phase::Held;
+					trains.heldAt[i] = brake;
+					report.blocks[brake].stops++;
+				}
+				else if (v <= 0.0 && brake < 0 && !propelled) {
+					report.stuck = true;
+					report.stuckS = s;
+				}
+			}
+			time += dt;
+		}
+
+		report.simulatedSeconds = time;
+		report.ridersPerHour = time > 0.0 && !report.stuck ? report.dispatches * settings.physics.train.carCount * settings.seatsPerCar * 3600.0 / time : 0.0;
+		report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return report;
+	}
+
+	// One report per settings, the runs spread over all cores
+	static std::vector<Report> runBatch(const Track& track, const std::vector<Settings>& runs)
+	{
+		std::vector<Report> reports(runs.size());
+		parallelFor(runs.size(), [&](size_t begin, size_t end) {
+			DispatchSimulation simulation;
+			for (size_t i = begin; i < end; i++) {
+				simulation.settings = runs[i];
+				reports[i] = simulation.run(track);
+			}
+		});
+		return reports;
+	}
+
+private:
+	enum class Phase : uint8_t {
+		Parked,  // waiting for the station before the first dispatch
+		Loading,
+		Ready,   // loaded, waiting for the first block or the dispatch interval
+		Running,
+		Held,    // stopped at a closed block brake
+		Stacked  // at the end of the track, waiting for the station
+	};
+
+	// Per train, one array per field
+	struct Trains {
+		std::vector<float>              s;
+		std::vector<float>              v;
+		std::vector<double>             timer; // end of the dwell
+		std::vector<Phase>              phase;
+		std::vector<int>                heldAt; // the block whose brake holds the train
+		std::vector<TrackZones::Cursor> cursor;
+
+		size_t size() const
+		{
+			return s.size();
+		}
+
+		void resize(size_t count)
+		{
+			s.resize(count);
+			v.resize(count);
+			timer.resize(count);
+			phase.resize(count);
+			heldAt.resize(count);
+			cursor.resize(count);
+		}
+	} trains;
+
+	std::vector<float> boundaries;  // start of each block
+	std::vector<int>   brakeBlock;  // per zone, the block a block brake ends, -1 for other zones
+
+	void splitBlocks(const TrackZones& zones, float totalLength, Report& report)
+	{
+		std::vector<uint32_t> brakes;
+		for (uint32_t z = 0; z < zones.zones.size(); z++) {
+			const TrackZone& zone = zones[z];
+			if (zone.type == TrackZone::Type::BlockBrake && zone.start < zone.end && zone.end < totalLength) brakes.push_back(z);
+		}
+		std::sort(brakes.begin(), brakes.end(), [&](uint32_t a, uint32_t b) { return zones[a].end < zones[b].end; });
+
+		boundaries = { 0.0f };
+		brakeBlock.assign(zones.zones.size(), -1);
+		for (uint32_t z : brakes) {
+			if (zones[z].end <= boundaries.back()) continue;
+			brakeBlock[z] = static_cast<int>(boundaries.size()) - 1;
+			boundaries.push_back(zones[z].end);
+		}
+
+		report.blocks.resize(boundaries.size());
+		for (size_t b = 0; b < boundaries.size(); b++) {
+			report.blocks[b].start = boundaries[b];
+			report.blocks[b].end = b + 1 < boundaries.size() ? boundaries[b + 1] : totalLength;
+		}
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <nlohmann/json.hpp>
+
+#include "support_structures.h"
+#include "track_mesh.h"
+
+namespace osp
+{
+
+// Writes the track mesh and its supports as a binary glTF 2.0 file (.glb).
+// The layout of the binary chunk is known from the chunk sizes alone, so the JSON is written first and the
+// vertex and index buffers of the chunks are streamed after it, without assembling the file in memory.
+// With quantize set the TrackVertex buffers are written as they are (KHR_mesh_quantization): positions
+// stay 16 bit relative to the chunk origin, which becomes the translation and scale of the chunk's node.
+// Only the most detailed LOD of every chunk is exported.
+struct GltfExporter
+{
+	bool      quantize = true;
+	glm::vec3 trackColor{ 0.1f, 0.2f, 1.0f };
+	glm::vec3 supportColor{ 0.55f, 0.55f, 0.58f };
+
+	struct Stats {
+		size_t   bytes = 0;
+		uint32_t chunks = 0;
+		uint32_t vertices = 0;
+		uint32_t triangles = 0;
+		uint32_t supports = 0;
+	} stats;
+
+	// Throws std::runtime_error when the file cannot be written
+	void exportGlb(const std::string& path, const TrackMesh& mesh, const SupportStructures* supports = nullptr)
+	{
+		stats = {};
+		collectRanges(mesh);
+		buildCylinder();
+
+		nlohmann::json gltf = buildJson(supports);
+		std::string    json = gltf.dump();
+		json.resize(align4(json.size()), ' ');
+
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			throw std::runtime_error("failed to open " + path);
+		}
+
+		uint32_t totalSize = static_cast<uint32_t>(12 + 8 + json.size() + (binSize > 0 ? 8 + binSize : 0));
+		writeU32(out, 0x46546C67); // "glTF"
+		writeU32(out, 2);
+		writeU32(out, totalSize);
+
+		writeU32(out, static_cast<uint32_t>(json.size()));
+		writeU32(out, 0x4E4F534A); // "JSON"
+		out.write(json.data(), json.size());
+
+		if (binSize > 0) {
+			writeU32(out, static_cast<uint32_t>(binSize));
+			writeU32(out, 0x004E4942); // "BIN"
+			writeBin(out);
+		}
+
+		if (!out) {
+			throw std::runtime_error("failed to write " + path);
+		}
+		stats.bytes = totalSize;
+	}
+
+private:
+	// glTF component types
+	static constexpr int BYTE = 5120;
+	static constexpr int UNSIGNED_SHORT = 5123;
+	static constexpr int SHORT = 5122;
+	static constexpr int FLOAT = 5126;
+
+	static constexpr int CYLINDER_SEGMENTS = 8;
+
+	// LOD 0 of one chunk and where its data ends up in the binary chunk
+	struct Range {
+		const TrackMesh::Chunk* chunk;
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		size_t   vertexOffset; // into the position view, also the index of the first vertex in the other views
+		size_t   indexOffset;
+	};
+
+	std::vector<Range> ranges;
+	size_t             vertexTotal = 0;
+	size_t             indexTotal = 0;
+
+	// byte offsets and lengths of the buffer views, in order: positions (with texcoords when quantized),
+	// normals, texcoords (float only), indices, cylinder positions, cylinder normals, cylinder indices
+	enum View { Positions, Normals, TexCoords, Indices, CylinderPositions, CylinderNormals, CylinderIndices, VIEW_COUNT };
+	std::array<size_t, VIEW_COUNT> viewOffset{};
+	std::array<size_t, VIEW_COUNT> viewLength{};
+	size_t binSize = 0;
+
+	std::vector<glm::vec3> cylinderPositions;
+	std::vector<glm::vec3> cylinderNormals;
+	std::vector<uint16_t>  cylinderIndices;
+
+	static size_t align4(size_t n)
+	{
+		return (n + 3) & ~size_t(3);
+	}
+
+	static void writeU32(std::ofstream& out, uint32_t v)
+	{
+		out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+	}
+
+	static void pad(std::ofstream& out, size_t written)
+	{
+		static const char zeros[4] = {};
+		out.write(zeros, align4(written) - written);
+	}
+
+	size_t positionStride() const { return quantize ? sizeof(TrackVertex) : sizeof(glm::vec3); }
+	size_t normalStride() const { return quantize ? 4 : sizeof(glm::vec3); }
+
+	void collectRanges(const TrackMesh& mesh)
+	{
+		ranges.clear();
+		vertexTotal = 0;
+		indexTotal = 0;
+		for (const auto& chunk : mesh.chunks) {
+			const auto& lod = chunk.lods[0];
+			if (lod.indexCount == 0) continue;
+
+			Range range{ &chunk, static_cast<uint32_t>(lod.vertexOffset), mesh.rangeVertexCount(chunk, 0), vertexTotal, indexTotal };
+			ranges.push_back(range);
+
+			vertexTotal += range.vertexCount;
+			indexTotal += lod.indexCount;
+			stats.vertices += range.vertexCount;
+			stats.triangles += lod.indexCount / 3;
+		}
+		stats.chunks = static_cast<uint32_t>(ranges.size());
+	}
+
+	// Unit cylinder along +y, instanced by one node per support
+	void buildCylinder()
+	{
+		cylinderPositions.clear();
+		cylinderNormals.clear();
+		cylinderIndices.clear();
+		for (int k = 0; k <= CYLINDER_SEGMENTS; k++) {
+			float angle = glm::two_pi<float>() * k / CYLINDER_SEGMENTS;
+			glm::vec3 normal(glm::cos(angle), 0.0f, -glm::sin(angle));
+			for (float y : { 0.0f, 1.0f }) {
+				cylinderPositions.push_back(normal + glm::vec3(0.0f, y, 0.0f));
+				cylinderNormals.push_back(normal);
+			}
+		}
+		for (uint16_t k = 0; k < CYLINDER_SEGMENTS; k++) {
+			uint16_t a = 2 * k;
+			for (uint16_t i : { a, uint16_t(a + 2), uint16_t(a + 1), uint16_t(a + 1), uint16_t(a + 2), uint16_t(a + 3) }) {
+				cylinderIndices.push_back(i);
+			}
+		}
+	}
+
+	void layoutViews()
+	{
+		viewLength[Positions] = vertexTotal * positionStride();
+		viewLength[Normals] = vertexTotal * normalStride();
+		viewLength[TexCoords] = quantize ? 0 : vertexTotal * sizeof(glm::vec2);
+		viewLength[Indices] = indexTotal * sizeof(uint16_t);
+		viewLength[CylinderPositions] = cylinderPositions.size() * sizeof(glm::vec3);
+		viewLength[CylinderNormals] = cylinderNormals.size() * sizeof(glm::vec3);
+		viewLength[CylinderIndices] = cylinderIndices.size() * sizeof(uint16_t);
+
+		size_t offset = 0;
+		for (int v = 0; v < VIEW_COUNT; v++) {
+			viewOffset[v] = offset;
+			offset += align4(viewLength[v]);
+		}
+		binSize = offset;
+	}
+
+	nlohmann::json buildJson(const SupportStructures* supports)
+	{
+		using nlohmann::json;
+		layoutViews();
+
+		json gltf;
+		gltf["asset"] = { { "version", "2.0" }, { "generator", "Osprey" } };
+		if (quantize) {
+			gltf["extensionsUsed"] = { "KHR_mesh_quantization" };
+			gltf["extensionsRequired"] = { "KHR_mesh_quantization" };
+		}
+		gltf["buffers"] = json::array({ { { "byteLength", binSize } } });
+
+		json& views = gltf["bufferViews"] = json::array();
+		auto addView = [&](View v, size_t stride, int target) {
+			json view = { { "buffer", 0 }, { "byteOffset", viewOffset[v] }, { "byteLength", viewLength[v] }, { "target", target } };
+			if (stride) view["byteStride"] = stride;
+			views.push_back(view);
+			return views.size() - 1;
+		};
+		constexpr int ARRAY_BUFFER = 34962;
+		constexpr int ELEMENT_ARRAY_BUFFER = 34963;
+
+		bool   hasTrack = vertexTotal > 0;
+		size_t positionView = 0, normalView = 0, texCoordView = 0, indexView = 0;
+		if (hasTrack) {
+			positionView = addView(Positions, positionStride(), ARRAY_BUFFER);
+			normalView = addView(Normals, normalStride(), ARRAY_BUFFER);
+			texCoordView = quantize ? positionView : addView(TexCoords, sizeof(glm::vec2), ARRAY_BUFFER);
+			indexView = addView(Indices, 0, ELEMENT_ARRAY_BUFFER);
+		}
+
+		gltf["materials"] = json::array({
+			material("Track", trackColor),
+			material("Supports", supportColor) });
+
+		json& accessors = gltf["accessors"] = json::array();
+		json& meshes = gltf["meshes"] = json::array();
+		json& nodes = gltf["nodes"] = json::array();
+		json  roots = json::array();
+
+		auto addAccessor = [&](json accessor) {
+			accessors.push_back(std::move(accessor));
+			return accessors.size() - 1;
+		};
+
+		// track, one mesh and node per chunk
+		json trackChildren = json::array();
+		for (const Range& range : ranges) {
+			const auto& chunk = *range.chunk;
+			const auto& lod = chunk.lods[0];
+
+			json position = { { "bufferView", positionView }, { "count", range.vertexCount }, { "type", "VEC3" } };
+			json normal = { { "bufferView", normalView }, { "count", range.vertexCount }, { "type", "VEC3" } };
+			json texCoord = { { "bufferView", texCoordView }, { "count", range.vertexCount }, { "type", "VEC2" } };
+
+			if (quantize) {
+				glm::ivec3 lo(32767), hi(-32768);
+				for (uint32_t v = 0; v < range.vertexCount; v++) {
+					const TrackVertex& vertex = chunk.mesh.data.vertices[range.firstVertex + v];
+					glm::ivec3 p(vertex.pos[0], vertex.pos[1], vertex.pos[2]);
+					lo = glm::min(lo, p);
+					hi = glm::max(hi, p);
+				}
+				position.update({ { "byteOffset", range.vertexOffset * sizeof(TrackVertex) }, { "componentType", SHORT }, { "normalized", true },
+					{ "min", { lo.x, lo.y, lo.z } }, { "max", { hi.x, hi.y, hi.z } } });
+				normal.update({ { "byteOffset", range.vertexOffset * 4 }, { "componentType", BYTE }, { "normalized", true } });
+				texCoord.update({ { "byteOffset", range.vertexOffset * sizeof(TrackVertex) + offsetof(TrackVertex, texCoord) }, { "componentType", UNSIGNED_SHORT }, { "normalized", true } });
+			}
+			else {
+				glm::vec3 lo(std::numeric_limits<float>::max()), hi(std::numeric_limits<float>::lowest());
+				for (uint32_t v = 0; v < range.vertexCount; v++) {
+					glm::vec3 p = chunk.mesh.data.vertices[range.firstVertex + v].decodePosition(chunk.origin);
+					lo = glm::min(lo, p);
+					hi = glm::max(hi, p);
+				}
+				position.update({ { "byteOffset", range.vertexOffset * sizeof(glm::vec3) }, { "componentType", FLOAT },
+					{ "min", { lo.x, lo.y, lo.z } }, { "max", { hi.x, hi.y, hi.z } } });
+				normal.update({ { "byteOffset", range.vertexOffset * sizeof(glm::vec3) }, { "componentType", FLOAT } });
+				texCoord.update({ { "byteOffset", range.vertexOffset * sizeof(glm::vec2) }, { "componentType", FLOAT } });
+			}
+
+			json indices = { { "bufferView", indexView }, { "byteOffset", range.indexOffset * sizeof(uint16_t) },
+				{ "componentType", UNSIGNED_SHORT }, { "count", lod.indexCount }, { "type", "SCALAR" } };
+
+			json primitive = {
+				{ "attributes", { { "POSITION", addAccessor(position) }, { "NORMAL", addAccessor(normal) }, { "TEXCOORD_0", addAccessor(texCoord) } } },
+				{ "indices", addAccessor(indices) },
+				{ "material", 0 } };
+			meshes.push_back({ { "name", "Track " + std::to_string(meshes.size()) }, { "primitives", json::array({ primitive }) } });
+
+			json node = { { "mesh", meshes.size() - 1 } };
+			if (quantize) {
+				node["translation"] = { chunk.origin.x, chunk.origin.y, chunk.origin.z };
+				node["scale"] = { chunk.origin.w, chunk.origin.w, chunk.origin.w };
+			}
+			nodes.push_back(node);
+			trackChildren.push_back(nodes.size() - 1);
+		}
+		if (!trackChildren.empty()) {
+			nodes.push_back({ { "name", "Track" }, { "children", trackChildren } });
+			roots.push_back(nodes.size() - 1);
+		}
+
+		// supports, one shared cylinder placed by a node per instance
+		if (supports && !supports->instances.empty()) {
+			size_t cylinderPositionView = addView(CylinderPositions, 0, ARRAY_BUFFER);
+			size_t cylinderNormalView = addView(CylinderNormals, 0, ARRAY_BUFFER);
+			size_t cylinderIndexView = addView(CylinderIndices, 0, ELEMENT_ARRAY_BUFFER);
+
+			json primitive = {
+				{ "attributes", {
+					{ "POSITION", addAccessor({ { "bufferView", cylinderPositionView }, { "componentType", FLOAT }, { "count", cylinderPositions.size() }, { "type", "VEC3" },
+						{ "min", { -1.0f, 0.0f, -1.0f } }, { "max", { 1.0f, 1.0f, 1.0f } } }) },
+					{ "NORMAL", addAccessor({ { "bufferView", cylinderNormalView }, { "componentType", FLOAT }, { "count", cylinderNormals.size() }, { "type", "VEC3" } }) } } },
+				{ "indices", addAccessor({ { "bufferView", cylinderIndexView }, { "componentType", UNSIGNED_SHORT }, { "count", cylinderIndices.size() }, { "type", "SCALAR" } }) },
+				{ "material", 1 } };
+			meshes.push_back({ { "name", "Support" }, { "primitives", json::array({ primitive }) } });
+			size_t cylinderMesh = meshes.size() - 1;
+
+			json supportChildren = json::array();
+			for (const auto& instance : supports->instances) {
+				glm::vec3 start(instance.start), end(instance.end);
+				float     length = glm::distance(start, end);
+				if (length <= 0.0f) continue;
+
+				glm::quat rotation(glm::vec3(0.0f, 1.0f, 0.0f), (end - start) / length);
+				nodes.push_back({
+					{ "mesh", cylinderMesh },
+					{ "translation", { start.x, start.y, start.z } },
+					{ "rotation", { rotation.x, rotation.y, rotation.z, rotation.w } },
+					{ "scale", { instance.start.w, length, instance.start.w } } });
+				supportChildren.push_back(nodes.size() - 1);
+				stats.supports++;
+			}
+			if (!supportChildren.empty()) {
+				nodes.push_back({ { "name", "Supports" }, { "children", supportChildren } });
+				roots.push_back(nodes.size() - 1);
+			}
+		}
+		else {
+			viewLength[CylinderPositions] = viewLength[CylinderNormals] = viewLength[CylinderIndices] = 0;
+			binSize = viewOffset[CylinderPositions];
+		}
+		gltf["buffers"][0]["byteLength"] = binSize;
+
+		gltf["scenes"] = json::array({ { { "nodes", roots } } });
+		gltf["scene"] = 0;
+
+		// top level arrays must not be empty
+		if (accessors.empty()) gltf.erase("accessors");
+		if (nodes.empty()) gltf.erase("nodes");
+		if (meshes.empty()) gltf.erase("meshes");
+		if (views.empty()) gltf.erase("bufferViews");
+		if (binSize == 0) gltf.erase("buffers");
+		return gltf;
+	}
+
+	static nlohmann::json material(const char* name, glm::vec3 color)
+	{
+		return {
+			{ "name", name },
+			{ "pbrMetallicRoughness", {
+				{ "baseColorFactor", { color.x, color.y, color.z, 1.0f } },
+				{ "metallicFactor", 0.8f },
+				{ "roughnessFactor", 0.35f } } } };
+	}
+
+	// Streams the buffer views in the order of layoutViews(), converting through a small block where needed
+	void writeBin(std::ofstream& out)
+	{
+		// positions
+		if (quantize) {
+			for (const Range& range : ranges) {
+				out.write(reinterpret_cast<const char*>(&range.chunk->mesh.data.vertices[range.firstVertex]), range.vertexCount * sizeof(TrackVertex));
+			}
+		}
+		else {
+			writeConverted<glm::vec3>(out, [](const TrackVertex& v, const glm::vec4& origin) { return v.decodePosition(origin); });
+		}
+		pad(out, viewLength[Positions]);
+
+		// normals
+		if (quantize) {
+			writeConverted<std::array<int8_t, 4>>(out, [](const TrackVertex& v, const glm::vec4&) {
+				glm::vec3 n = TrackVertex::octDecode(glm::vec2(v.normal[0], v.normal[1]) / 32767.0f);
+				return std::array<int8_t, 4>{ snorm8(n.x), snorm8(n.y), snorm8(n.z), 0 };
+			});
+		}
+		else {
+			writeConverted<glm::vec3>(out, [](const TrackVertex& v, const glm::vec4&) {
+				return TrackVertex::octDecode(glm::vec2(v.normal[0], v.normal[1]) / 32767.0f);
+			});
+		}
+		pad(out, viewLength[Normals]);
+
+		// texcoords, part of the position view when quantized
+		if (!quantize) {
+			writeConverted<glm::vec2>(out, [](const TrackVertex& v, const glm::vec4&) {
+				return glm::vec2(v.texCoord[0], v.texCoord[1]) / 65535.0f;
+			});
+			pad(out, viewLength[TexCoords]);
+		}
+
+		// indices are already local to the range's first vertex
+		for (const Range& range : ranges) {
+			const auto& lod = range.chunk->lods[0];
+			out.write(reinterpret_cast<const char*>(&range.chunk->mesh.data.indices[lod.firstIndex]), lod.indexCount * sizeof(uint16_t));
+		}
+		pad(out, viewLength[Indices]);
+
+		if (viewLength[CylinderPositions] > 0) {
+			out.write(reinterpret_cast<const char*>(cylinderPositions.data()), viewLength[CylinderPositions]);
+			pad(out, viewLength[CylinderPositions]);
+			out.write(reinterpret_cast<const char*>(cylinderNormals.data()), viewLength[CylinderNormals]);
+			pad(out, viewLength[CylinderNormals]);
+			out.write(reinterpret_cast<const char*>(cylinderIndices.data()), viewLength[CylinderIndices]);
+			pad(out, viewLength[CylinderIndices]);
+		}
+	}
+
+	static int8_t snorm8(float v)
+	{
+		return static_cast<int8_t>(glm::round(glm::clamp(v, -1.0f, 1.0f) * 127.0f));
+	}
+
+	// Converts every exported vertex with f and writes the results block by block
+	template <typename T, typename F>
+	void writeConverted(std::ofstream& out, F&& f)
+	{
+		constexpr size_t BLOCK = 4096;
+		std::vector<T>   block(BLOCK);
+		size_t           count = 0;
+
+		for (const Range& range : ranges) {
+			const auto& vertices = range.chunk->mesh.data.vertices;
+			for (uint32_t v = 0; v < range.vertexCount; v++) {
+				block[count++] = f(vertices[range.firstVertex + v], range.chunk->origin);
+				if (count == BLOCK) {
+					out.write(reinterpret_cast<const char*>(block.data()), count * sizeof(T));
+					count = 0;
+				}
+			}
+		}
+		out.write(reinterpret_cast<const char*>(block.data()), count * sizeof(T));
+	}
+};
+
+} // namespace osp
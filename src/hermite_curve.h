@@ -49,6 +49,11 @@ namespace osp {
 
 		HermiteCurve() = default;
 
+		std::unique_ptr<ICurve> clone() const override
+		{
+			return std::make_unique<HermiteCurve>(*this);
+		}
+
 		void update() override
 		{
 			calculateTangents();
@@ -59,6 +64,14 @@ namespace osp {
 			return cumulativeLengths.empty() ? 0.0f : cumulativeLengths.back();
 		}
 
+		size_t getNumSegments() const override {
+			return cumulativeLengths.size();
+		}
+
+		float getSegmentEndLength(size_t i) const override {
+			return cumulativeLengths[i];
+		}
+
 		void extendBack() override
 		{
 			float segmentLength = segmentLengths.back();
@@ -185,6 +198,22 @@ namespace osp {
 			return forward;
 		}
 
+		void getTangentsAtLengths(const float* s, glm::vec3* tangents, size_t count) override
+		{
+			size_t seg = 0;
+			for (size_t k = 0; k < count; k++) {
+				if (cumulativeLengths.empty()) {
+					tangents[k] = UP_DIR;
+					continue;
+				}
+				seg = walkToSegment(cumulativeLengths, glm::clamp(s[k], 0.0f, cumulativeLengths.back()), seg);
+				float localT = (s[k] - (seg == 0 ? 0.0f : cumulativeLengths[seg - 1])) / segmentLengths[seg];
+				tangents[k] = hermiteDerivative(
+					controlPoints[seg], controlTangents[seg],
+					controlPoints[seg + 1], controlTangents[seg + 1], localT);
+			}
+		}
+
 		glm::vec3 getControlPoint(size_t i) override
 		{
 			return controlPoints[i];
@@ -204,6 +233,11 @@ namespace osp {
 		{
 			controlPoints.push_back(value);
 		}
+		// tangents and lengths are recomputed by update()
+		void insertControlPoint(size_t i, glm::vec3 value) override
+		{
+			controlPoints.insert(controlPoints.begin() + i, value);
+		}
 
 		glm::vec3 evaluate(float s, size_t* i = nullptr) override
 		{
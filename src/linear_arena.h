@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace osp
+{
+
+// Bump allocator for the temporaries of a mesh rebuild, handed to std::pmr containers.
+// Deallocation is a no-op, memory is given back all at once with rewind() or reset(). reset() keeps the
+// memory and merges it into one block as large as the most ever used, so once a rebuild of similar size
+// has run, later rebuilds are served without touching the heap.
+class LinearArena : public std::pmr::memory_resource
+{
+public:
+	struct Stats {
+		size_t allocations = 0;         // served since the last reset()
+		size_t upstreamAllocations = 0; // blocks taken from the heap since the last reset()
+		size_t bytesUsed = 0;           // high water mark since the last reset()
+		size_t capacity = 0;
+	};
+
+	explicit LinearArena(size_t initialSize = 1 << 20)
+		: nextBlockSize(initialSize)
+	{}
+
+	// Gives back everything allocated while the scope was open
+	class Scope
+	{
+	public:
+		explicit Scope(LinearArena& arena)
+			: arena(arena), mark(arena.position())
+		{}
+
+		~Scope()
+		{
+			arena.rewind(mark);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		LinearArena& arena;
+		size_t       mark;
+	};
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	~LinearArena() override
+	{
+		for (Block& block : blocks) {
+			::operator delete(block.data);
+		}
+	}
+
+	size_t position() const
+	{
+		return used;
+	}
+
+	// Frees everything allocated after position() returned mark
+	void rewind(size_t mark)
+	{
+		used = mark;
+		while (current > 0 && blocks[current].base >= used) {
+			current--;
+		}
+	}
+
+	// Frees everything, and replaces the blocks with a single one when more than one was needed
+	void reset()
+	{
+		if (blocks.size() > 1) {
+			size_t size = std::max(highWater, nextBlockSize);
+			for (Block& block : blocks) {
+				::operator delete(block.data);
+			}
+			blocks.clear();
+			addBlock(size);
+		}
+		used = 0;
+		current = 0;
+		stats = {};
+		stats.capacity = capacity();
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Block {
+		std::byte* data;
+		size_t     size;
+		size_t     base; // position() of the first byte
+	};
+
+	std::vector<Block> blocks;
+	size_t current = 0;
+	size_t used = 0;
+	size_t highWater = 0;
+	size_t nextBlockSize;
+	Stats  stats;
+
+	size_t capacity() const
+	{
+		return blocks.empty() ? 0 : blocks.back().base + blocks.back().size;
+	}
+
+	void addBlock(size_t size)
+	{
+		size_t base = blocks.empty() ? 0 : blocks.back().base + blocks.back().size;
+		blocks.push_back({ static_cast<std::byte*>(::operator new(size)), size, base });
+		stats.upstreamAllocations++;
+		stats.capacity = capacity();
+	}
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		stats.allocations++;
+		for (;;) {
+			if (current < blocks.size()) {
+				Block&    block = blocks[current];
+				size_t    offset = used > block.base ? used - block.base : 0;
+				uintptr_t address = reinterpret_cast<uintptr_t>(block.data) + offset;
+				size_t    padding = (alignment - address % alignment) % alignment;
+
+				if (offset + padding + bytes <= block.size) {
+					used = block.base + offset + padding + bytes;
+					highWater = std::max(highWater, used);
+					stats.bytesUsed = std::max(stats.bytesUsed, used);
+					return block.data + offset + padding;
+				}
+				if (current + 1 < blocks.size()) {
+					current++;
+					used = blocks[current].base;
+					continue;
+				}
+			}
+			if (!blocks.empty()) nextBlockSize *= 2;
+			nextBlockSize = std::max(nextBlockSize, bytes + alignment);
+			addBlock(nextBlockSize);
+			current = blocks.size() - 1;
+			used = blocks[current].base;
+		}
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+} // namespace osp
@@ -11,28 +11,41 @@ import vulkan_hpp;
 #endif
 
 #include "gpu_buffer.h"
+#include "upload_queue.h"
 #include "vertex.h"
 
 namespace osp
 {
 
-struct Mesh 
+template <typename VertexT, typename IndexT = uint32_t>
+struct BasicMesh 
 {
 	struct MeshData
 	{
-		std::vector<Vertex> vertices;
-		std::vector<uint32_t> indices;
+		std::vector<VertexT> vertices;
+		std::vector<IndexT> indices;
 	} data;
 	GpuBuffer vertexBuffer;
 	GpuBuffer indexBuffer;
 
-	Mesh() = default;
+	BasicMesh() = default;
 
 	void upload(VkContext& context, vk::raii::CommandPool& commandPool)
 	{
 		vertexBuffer.upload(context, commandPool, sizeof(data.vertices[0]) * data.vertices.size(), vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, data.vertices.data());
 		indexBuffer.upload(context, commandPool, sizeof(data.indices[0]) * data.indices.size(), vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, data.indices.data());
 	}
+
+	// Queued without waiting, see UploadQueue
+	void upload(UploadQueue& uploads)
+	{
+		uploads.upload(vertexBuffer, sizeof(data.vertices[0]) * data.vertices.size(), vk::BufferUsageFlagBits::eVertexBuffer, data.vertices.data());
+		uploads.upload(indexBuffer, sizeof(data.indices[0]) * data.indices.size(), vk::BufferUsageFlagBits::eIndexBuffer, data.indices.data());
+	}
 };
 
+using Mesh = BasicMesh<Vertex>;
+// Indices are local to a draw range and never exceed 16 bit, see TrackMesh::MAX_RANGE_VERTICES
+using TrackChunkMesh = BasicMesh<TrackVertex, uint16_t>;
+
 }
\ No newline at end of file
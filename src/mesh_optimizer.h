@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Index reordering for the post-transform vertex cache and overdraw.
+// Based on "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab, Barczak 2007)
+// Scratch memory comes from the given memory resource, TrackMesh passes its per-rebuild arena.
+
+namespace osp {
+
+constexpr int VERTEX_CACHE_SIZE = 16;
+
+// Average cache miss ratio (transformed vertices per triangle) for a FIFO cache of cacheSize entries.
+// 3.0 is the worst case, 0.5 the theoretical optimum for a large regular grid.
+template <typename IndexT>
+float computeAcmr(const IndexT* indices, size_t indexCount, uint32_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE,
+	std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+	if (indexCount < 3) return 0.0f;
+
+	// a vertex is in the cache while fewer than cacheSize misses happened since it was inserted
+	std::pmr::vector<uint32_t> insertedAt(vertexCount, 0, memory);
+	uint32_t misses = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t v = indices[i];
+		if (insertedAt[v] == 0 || misses - insertedAt[v] >= (uint32_t)cacheSize) {
+			misses++;
+			insertedAt[v] = misses;
+		}
+	}
+	return (float)misses / (float)(indexCount / 3);
+}
+
+// Reorders the triangles in place with the Tipsify algorithm. When clusterStarts is given, it receives the
+// first triangle of every cluster, a cluster ending wherever the fan walk hit a dead end.
+template <typename IndexT>
+void tipsify(IndexT* indices, size_t indexCount, uint32_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE,
+	std::pmr::vector<uint32_t>* clusterStarts = nullptr, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+	const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	if (triangleCount == 0) return;
+
+	// vertex -> triangle adjacency in compressed rows
+	std::pmr::vector<uint32_t> liveTriangles(vertexCount, 0, memory);
+	for (size_t i = 0; i < indexCount; i++) {
+		liveTriangles[indices[i]]++;
+	}
+	std::pmr::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0, memory);
+	uint32_t                   maxValence = 0;
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		maxValence = std::max(maxValence, liveTriangles[v]);
+	}
+	std::pmr::vector<uint32_t> adjacency(adjacencyOffsets[vertexCount], memory);
+	{
+		std::pmr::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1, memory);
+		for (uint32_t t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				adjacency[fill[indices[3 * t + k]]++] = t;
+			}
+		}
+	}
+
+	// sized up front so none of them grows: every emitted index is pushed once to deadEnds, and a fan
+	// yields at most three candidates per triangle around the fanning vertex
+	std::pmr::vector<uint32_t> cacheTime(vertexCount, 0, memory);
+	std::pmr::vector<uint8_t>  emitted(triangleCount, 0, memory);
+	std::pmr::vector<uint32_t> deadEnds(memory);
+	std::pmr::vector<uint32_t> candidates(memory);
+	std::pmr::vector<IndexT>   output(memory);
+	deadEnds.reserve(indexCount);
+	candidates.reserve(3 * maxValence);
+	output.reserve(indexCount);
+
+	uint32_t timeStamp = cacheSize + 1;
+	uint32_t cursor = 1;
+
+	auto skipDeadEnd = [&]() -> int64_t {
+		while (!deadEnds.empty()) {
+			uint32_t d = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[d] > 0) return d;
+		}
+		while (cursor < vertexCount) {
+			if (liveTriangles[cursor] > 0) return cursor;
+			cursor++;
+		}
+		return -1;
+	};
+
+	int64_t fanning = 0;
+	if (clusterStarts) {
+		clusterStarts->clear();
+		clusterStarts->push_back(0);
+	}
+
+	while (fanning >= 0) {
+		candidates.clear();
+
+		for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+
+			for (int k = 0; k < 3; k++) {
+				IndexT v = indices[3 * t + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (timeStamp - cacheTime[v] > (uint32_t)cacheSize) {
+					cacheTime[v] = timeStamp++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// prefer the candidate that is still in cache and whose remaining fan fits into it
+		int64_t  next = -1;
+		int64_t  bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) continue;
+
+			int64_t priority = 0;
+			if (timeStamp - cacheTime[v] + 2 * liveTriangles[v] <= (uint32_t)cacheSize) {
+				priority = timeStamp - cacheTime[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				next = v;
+			}
+		}
+		if (next == -1) {
+			next = skipDeadEnd();
+			if (clusterStarts && next >= 0 && output.size() < indexCount) {
+				clusterStarts->push_back(static_cast<uint32_t>(output.size() / 3));
+			}
+		}
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+// Sorts the clusters found by tipsify() so that triangles facing away from the mesh center come first.
+// Occluders on the outside of the mesh are then drawn before what they hide.
+template <typename IndexT>
+void optimizeOverdraw(IndexT* indices, size_t indexCount, const glm::vec3* positions, const std::pmr::vector<uint32_t>& clusterStarts,
+	std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+	const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	const size_t   clusterCount = clusterStarts.size();
+	if (clusterCount < 2) return;
+
+	glm::vec3 meshCentroid(0.0f);
+	float     meshArea = 0.0f;
+
+	std::pmr::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f), memory);
+	std::pmr::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f), memory);
+
+	for (size_t c = 0; c < clusterCount; c++) {
+		uint32_t end = (c + 1 < clusterCount) ? clusterStarts[c + 1] : triangleCount;
+		float    clusterArea = 0.0f;
+
+		for (uint32_t t = clusterStarts[c]; t < end; t++) {
+			glm::vec3 p0 = positions[indices[3 * t + 0]];
+			glm::vec3 p1 = positions[indices[3 * t + 1]];
+			glm::vec3 p2 = positions[indices[3 * t + 2]];
+
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float     area = 0.5f * glm::length(n);
+			glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentroids[c] += center * area;
+			clusterNormals[c] += n;
+			clusterArea += area;
+
+			meshCentroid += center * area;
+			meshArea += area;
+		}
+		if (clusterArea > 0.0f) clusterCentroids[c] /= clusterArea;
+		float len = glm::length(clusterNormals[c]);
+		if (len > 0.0f) clusterNormals[c] /= len;
+	}
+	if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+	std::pmr::vector<float> sortKey(clusterCount, memory);
+	for (size_t c = 0; c < clusterCount; c++) {
+		sortKey[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+	}
+
+	// ties broken by cluster index, the same order as a stable sort but without its temporary buffer
+	std::pmr::vector<uint32_t> order(clusterCount, memory);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] != sortKey[b] ? sortKey[a] > sortKey[b] : a < b; });
+
+	std::pmr::vector<IndexT> output(memory);
+	output.reserve(indexCount);
+	for (uint32_t c : order) {
+		uint32_t end = (c + 1 < clusterCount) ? clusterStarts[c + 1] : triangleCount;
+		output.insert(output.end(), indices + 3 * clusterStarts[c], indices + 3 * end);
+	}
+	std::copy(output.begin(), output.end(), indices);
+}
+
+} // namespace osp
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "track.h"
+#include "track_mesh.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -8,6 +9,8 @@
 #include <ImGuizmo.h>
 #include <GLFW/glfw3.h>
 
+#include <chrono>
+#include <functional>
 #include <string>
 
 namespace osp {
@@ -30,6 +33,11 @@ struct NodeEditor {
 	size_t hoveredIndex = 0;
 	
 	bool* trackDirty;
+	std::function<void(float)> moveTrain; // called with the arc length shift clicked on the track
+
+	// Track surface under the cursor when no node is hovered, found with trackMesh->bvh
+	TrackBvh::Hit trackHover;
+	float pickMicroseconds = 0.0f;
 
 	const char* selectedNodeWindowId = "###SelectedNodeWindow";
 
@@ -50,10 +58,25 @@ struct NodeEditor {
 			if (glm::distance2(cursorPos, screenPos) < scale * scale * hoveringRadius * hoveringRadius) {
 				hovered = &node;
 				hoveredIndex = i;
+				trackHover = {};
 				return;
 			}
 		}
 		hovered = nullptr;
+		pickTrack(cursorPos);
+	}
+
+	void pickTrack(glm::vec2 cursorPos)
+	{
+		trackHover = {};
+		if (!trackMesh || trackMesh->bvh.chunkCount() == 0) return;
+
+		TrackBvh::Ray ray;
+		camera->screenRay(cursorPos, screenSize[0], screenSize[1], ray.origin, ray.direction);
+
+		auto start = std::chrono::steady_clock::now();
+		trackHover = trackMesh->bvh.intersect(ray);
+		pickMicroseconds = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
 	}
 
 	void onMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
@@ -65,9 +88,25 @@ struct NodeEditor {
 				selectedIndex = hoveredIndex;
 				hovered = nullptr;
 			}
+			else if (trackHover.valid() && (mods & GLFW_MOD_CONTROL)) {
+				insertNodeAt(trackHover.s);
+			}
+			else if (trackHover.valid() && (mods & GLFW_MOD_SHIFT) && moveTrain) {
+				moveTrain(trackHover.s);
+			}
 		}
 	}
 
+	// Adds a node at s without reshaping the track, see Track::splitAt(), which becomes selected
+	void insertNodeAt(float s)
+	{
+		size_t index = track->splitAt(s);
+		selected = &track->nodes[index];
+		selectedIndex = index;
+		trackHover = {};
+		*trackDirty = true;
+	}
+
 	void onKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
@@ -138,6 +177,13 @@ struct NodeEditor {
 
 
 
+		if (trackHover.valid() && !hovered) {
+			glm::vec2 screenPos = camera->projectPositionToScreen(trackHover.position, screenSize[0], screenSize[1]);
+			if (screenPos.x != -1.0f && screenPos.y != -1.0f) {
+				ImGui::GetBackgroundDrawList()->AddCircle(ImVec2(screenPos.x, screenPos.y), 6.0f, IM_COL32(230, 230, 230, 200), 0, 2.0f);
+			}
+		}
+
 		ImGui::Begin("Nodes");
 		bool wasSelectedEnumerated = false;
 		for (size_t i = 0; i < track->nodes.size(); i++) {
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+
 #include "curve.h"
 
 namespace osp {
@@ -81,6 +84,40 @@ namespace osp {
             return (denominator > 1e-7f) ? numerator / denominator : controlPoints[0];
         }
 
+        // evaluateNormalized() from the basis functions of span, knots[span] <= u < knots[span + 1], the only
+        // nonzero ones (The NURBS Book, A2.2). Moves span to u first.
+        glm::vec3 evaluateInSpan(float u, size_t& span) const {
+            if (u == 1.0f) u = 0.999999f;
+
+            size_t last = controlPoints.size() - 1;
+            span = std::clamp(span, static_cast<size_t>(degree), last);
+            while (span > static_cast<size_t>(degree) && u < knots[span]) span--;
+            while (span < last && u >= knots[span + 1]) span++;
+
+            std::array<float, 4> basis{ 1.0f }, left{}, right{};
+            for (int j = 1; j <= degree; j++) {
+                left[j] = u - knots[span + 1 - j];
+                right[j] = knots[span + j] - u;
+                float saved = 0.0f;
+                for (int r = 0; r < j; r++) {
+                    float temp = basis[r] / (right[r + 1] + left[j - r]);
+                    basis[r] = saved + right[r + 1] * temp;
+                    saved = left[j - r] * temp;
+                }
+                basis[j] = saved;
+            }
+
+            glm::vec3 numerator(0.0f);
+            float denominator = 0.0f;
+            for (int j = 0; j <= degree; j++) {
+                size_t i = span - degree + j;
+                float weighted_basis = basis[j] * weights[i];
+                numerator += weighted_basis * controlPoints[i];
+                denominator += weighted_basis;
+            }
+            return (denominator > 1e-7f) ? numerator / denominator : controlPoints[0];
+        }
+
         void calculateLength() {
             if (controlPoints.size() <= 1) {
                 segmentLengths.clear();
@@ -123,6 +160,10 @@ namespace osp {
             }
         }
 
+        std::unique_ptr<ICurve> clone() const override {
+            return std::make_unique<NURBSCurve>(*this);
+        }
+
         void update() override {
             if (controlPoints.empty()) return;
 
@@ -134,15 +175,62 @@ namespace osp {
             weights.resize(controlPoints.size(), 1.0f);
             pinned.resize(controlPoints.size(), false);
 
-            generateKnots();
+            // knots refined by insertKnot() or loaded with the track are kept while they fit the control points
+            if (knots.size() != controlPoints.size() + degree + 1) {
+                generateKnots();
+            }
             calculateLength();
         }
 
+        // Boehm's knot insertion at arc length s: adds a control point without changing the shape of the curve.
+        // The degree control points from first on replace the degree - 1 ones there before, control point i
+        // is blended from the old i - 1 and i by ratios[i - first]. Returns false when s is at an end.
+        bool insertKnot(float s, size_t& first, std::vector<float>& ratios) {
+            // below cubic the degree would change with the new control point, and the shape with it
+            if (degree < 3 || knots.size() != controlPoints.size() + degree + 1) return false;
+
+            float u = arcLengthToNormalized(s);
+            if (u <= knots[degree] || u >= knots[controlPoints.size()]) return false;
+
+            // span k holds u, knots[k] <= u < knots[k + 1]
+            size_t k = std::upper_bound(knots.begin(), knots.end(), u) - knots.begin() - 1;
+            first = k - degree + 1;
+
+            // blended in homogeneous coordinates, which keeps rational curves exact
+            std::vector<glm::vec4> blended(degree);
+            ratios.resize(degree);
+            for (size_t i = first; i <= k; i++) {
+                float a = (u - knots[i]) / (knots[i + degree] - knots[i]);
+                glm::vec4 p0(controlPoints[i - 1] * weights[i - 1], weights[i - 1]);
+                glm::vec4 p1(controlPoints[i] * weights[i], weights[i]);
+                blended[i - first] = glm::mix(p0, p1, a);
+                ratios[i - first] = a;
+            }
+
+            controlPoints.insert(controlPoints.begin() + k, glm::vec3(0.0f));
+            weights.insert(weights.begin() + k, 1.0f);
+            pinned.insert(pinned.begin() + k, false);
+            for (size_t i = first; i <= k; i++) {
+                controlPoints[i] = glm::vec3(blended[i - first]) / blended[i - first].w;
+                weights[i] = blended[i - first].w;
+            }
+            knots.insert(knots.begin() + k + 1, u);
+            return true;
+        }
+
         // ICurve interface
         float totalLength() const override {
             return cumulativeLengths.empty() ? 0.0f : cumulativeLengths.back();
         }
 
+        size_t getNumSegments() const override {
+            return cumulativeLengths.size();
+        }
+
+        float getSegmentEndLength(size_t i) const override {
+            return cumulativeLengths[i];
+        }
+
         glm::vec3 evaluate(float s, size_t* segmentIndex = nullptr) override {
             if (cumulativeLengths.empty()) return glm::vec3(0.0f);
 
@@ -170,14 +258,30 @@ namespace osp {
         }
 
         glm::vec3 getTangentAtLength(float s) override {
-            float u = s / (cumulativeLengths.empty() ? 1.0f : cumulativeLengths.back());
-            const float eps = 0.001f;
+            glm::vec3 tangent;
+            getTangentsAtLengths(&s, &tangent, 1);
+            return tangent;
+        }
 
-            glm::vec3 p1 = evaluateNormalized(glm::clamp(u - eps, 0.0f, 1.0f));
-            glm::vec3 p2 = evaluateNormalized(glm::clamp(u + eps, 0.0f, 1.0f));
+        // Central differences over u like evaluateNormalized(), but summing only the degree + 1 basis functions
+        // that are nonzero in the knot span of u. The span is found from the one before, quick for sorted s.
+        void getTangentsAtLengths(const float* s, glm::vec3* tangents, size_t count) override {
+            size_t n = controlPoints.size();
+            if (n <= static_cast<size_t>(degree) || degree > 3 || knots.size() != n + degree + 1) {
+                ICurve::getTangentsAtLengths(s, tangents, count);
+                return;
+            }
 
-            glm::vec3 tangent = p2 - p1;
-            return glm::length(tangent) > 1e-6f ? glm::normalize(tangent) : glm::vec3(0, 0, 1);
+            const float eps = 0.001f;
+            size_t span = degree;
+            for (size_t k = 0; k < count; k++) {
+                float u = s[k] / (cumulativeLengths.empty() ? 1.0f : cumulativeLengths.back());
+                glm::vec3 p1 = evaluateInSpan(glm::clamp(u - eps, 0.0f, 1.0f), span);
+                glm::vec3 p2 = evaluateInSpan(glm::clamp(u + eps, 0.0f, 1.0f), span);
+
+                glm::vec3 tangent = p2 - p1;
+                tangents[k] = glm::length(tangent) > 1e-6f ? glm::normalize(tangent) : glm::vec3(0, 0, 1);
+            }
         }
 
         float normalizedToArcLength(float u) override {
@@ -219,6 +323,12 @@ namespace osp {
             pinned.push_back(false);
         }
 
+        void insertControlPoint(size_t i, glm::vec3 value) override {
+            controlPoints.insert(controlPoints.begin() + i, value);
+            weights.insert(weights.begin() + i, 1.0f);
+            pinned.insert(pinned.begin() + i, false);
+        }
+
         void extendBack() override {
             if (controlPoints.size() >= 2) {
                 glm::vec3 lastDir = controlPoints.back() - controlPoints[controlPoints.size() - 2];
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace osp
+{
+
+// Splits [0, count) into contiguous blocks of at least minBlock items and calls f(begin, end) for each,
+// one block per hardware thread with the calling thread taking the first. Returns once all are done.
+template <typename F>
+void parallelFor(size_t count, F&& f, size_t minBlock = 1)
+{
+	if (count == 0) return;
+
+	size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	size_t blocks = std::min(threads, (count + minBlock - 1) / std::max<size_t>(1, minBlock));
+	size_t blockSize = (count + blocks - 1) / blocks;
+
+	std::vector<std::jthread> workers;
+	workers.reserve(blocks - 1);
+	for (size_t begin = blockSize; begin < count; begin += blockSize) {
+		workers.emplace_back([&f, begin, end = std::min(begin + blockSize, count)] { f(begin, end); });
+	}
+	f(0, std::min(blockSize, count));
+}
+
+} // namespace osp
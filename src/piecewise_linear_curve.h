@@ -103,6 +103,19 @@ struct PiecewiseLinearCurve : public ICurve {
 		return controlTangents[seg];
 	}
 
+	void getTangentsAtLengths(const float* s, glm::vec3* tangents, size_t count) override
+	{
+		size_t seg = 0;
+		for (size_t k = 0; k < count; k++) {
+			if (cumulativeLengths.empty()) {
+				tangents[k] = UP_DIR;
+				continue;
+			}
+			seg = walkToSegment(cumulativeLengths, glm::clamp(s[k], 0.0f, cumulativeLengths.back()), seg);
+			tangents[k] = controlTangents[seg];
+		}
+	}
+
 	glm::vec3 getControlPoint(size_t i) override
 	{
 		return controlPoints[i];
@@ -122,12 +135,27 @@ struct PiecewiseLinearCurve : public ICurve {
 	{
 		controlPoints.push_back(value);
 	}
+	// tangents and lengths are recomputed by update()
+	void insertControlPoint(size_t i, glm::vec3 value) override
+	{
+		controlPoints.insert(controlPoints.begin() + i, value);
+	}
 
 	float totalLength() const override
 	{
 		return cumulativeLengths.empty() ? 0.0f : cumulativeLengths.back();
 	}
 
+	size_t getNumSegments() const override
+	{
+		return cumulativeLengths.size();
+	}
+
+	float getSegmentEndLength(size_t i) const override
+	{
+		return cumulativeLengths[i];
+	}
+
 	void extendBack() override
 	{
 		float segmentLength = segmentLengths.back();
@@ -145,6 +173,11 @@ struct PiecewiseLinearCurve : public ICurve {
 		segmentLengths.pop_back();
 	}
 
+	std::unique_ptr<ICurve> clone() const override
+	{
+		return std::make_unique<PiecewiseLinearCurve>(*this);
+	}
+
 	void update() override
 	{
 		calculateLength();
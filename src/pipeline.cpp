@@ -16,6 +16,14 @@ Pipeline::Pipeline(VkContext& context, vk::Format colorFormat, vk::Format depthF
 	vk::DescriptorSetLayoutCreateInfo layoutInfo{ .bindingCount = static_cast<uint32_t>(bindings.size()), .pBindings = bindings.data() };
 	descriptorSetLayout = vk::raii::DescriptorSetLayout(context.device, layoutInfo);
 
+	std::vector<vk::DescriptorSetLayout> setLayouts = { *descriptorSetLayout };
+	if (config.vertexStorageBuffer) {
+		vk::DescriptorSetLayoutBinding storageBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr);
+		vk::DescriptorSetLayoutCreateInfo storageLayoutInfo{ .bindingCount = 1, .pBindings = &storageBinding };
+		storageSetLayout = vk::raii::DescriptorSetLayout(context.device, storageLayoutInfo);
+		setLayouts.push_back(*storageSetLayout);
+	}
+
 	vk::raii::ShaderModule shaderModule = createShaderModule(context, readFile(config.shaderPath));
 
 	vk::PipelineShaderStageCreateInfo vertShaderStageInfo{ .stage = vk::ShaderStageFlagBits::eVertex, .module = *shaderModule, .pName = config.vertexEntry.c_str()};
@@ -67,16 +75,37 @@ Pipeline::Pipeline(VkContext& context, vk::Format colorFormat, vk::Format depthF
 		vk::DynamicState::eDepthTestEnable };
 	vk::PipelineDynamicStateCreateInfo dynamicState{ .dynamicStateCount = static_cast<uint32_t>(dynamicStates.size()), .pDynamicStates = dynamicStates.data() };
 
-	vk::PipelineLayoutCreateInfo pipelineLayoutInfo{ .setLayoutCount = 1, .pSetLayouts = &*descriptorSetLayout, .pushConstantRangeCount = 0 };
+	vk::PushConstantRange pushConstantRange{
+		.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+		.offset = 0,
+		.size = config.pushConstantSize };
+	vk::PipelineLayoutCreateInfo pipelineLayoutInfo{ 
+		.setLayoutCount = static_cast<uint32_t>(setLayouts.size()), 
+		.pSetLayouts = setLayouts.data(), 
+		.pushConstantRangeCount = config.pushConstantSize > 0 ? 1u : 0u, 
+		.pPushConstantRanges = &pushConstantRange };
 
 	pipelineLayout = vk::raii::PipelineLayout(context.device, pipelineLayoutInfo);
 
 	vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
+	std::vector<vk::VertexInputBindingDescription> bindingDescriptions;
+	std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
 	if (config.hasVertexInput) {
-		auto                                   bindingDescription = Vertex::getBindingDescription();
-		auto                                   attributeDescriptions = Vertex::getAttributeDescriptions();
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+		if (config.vertexFormat == VertexFormat::Track) {
+			// geometry in binding 0, recolourable attributes in binding 1
+			bindingDescriptions = { TrackVertex::getBindingDescription(), TrackVertexAttributes::getBindingDescription() };
+			auto attributes = TrackVertex::getAttributeDescriptions();
+			auto colorAttributes = TrackVertexAttributes::getAttributeDescriptions();
+			attributeDescriptions.assign(attributes.begin(), attributes.end());
+			attributeDescriptions.insert(attributeDescriptions.end(), colorAttributes.begin(), colorAttributes.end());
+		}
+		else {
+			bindingDescriptions = { Vertex::getBindingDescription() };
+			auto attributes = Vertex::getAttributeDescriptions();
+			attributeDescriptions.assign(attributes.begin(), attributes.end());
+		}
+		vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+		vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 	}
@@ -7,6 +7,11 @@
 namespace osp {
 
 struct Pipeline {
+	enum class VertexFormat {
+		Standard, // osp::Vertex
+		Track     // osp::TrackVertex in binding 0, osp::TrackVertexAttributes in binding 1
+	};
+
 	struct Config {
         std::string           shaderPath;
         std::string           vertexEntry = "vertMain";
@@ -16,11 +21,15 @@ struct Pipeline {
         bool                  hasVertexInput = true;
         bool                  depthTest = true;
         bool                  depthWrite = true;
+        VertexFormat          vertexFormat = VertexFormat::Standard;
+        uint32_t              pushConstantSize = 0; // visible to vertex and fragment stage
+        bool                  vertexStorageBuffer = false; // read-only storage buffer for the vertex stage in set 1, binding 0
     };
 
 	vk::raii::Pipeline pipeline = nullptr;
 	vk::raii::PipelineLayout pipelineLayout = nullptr;
 	vk::raii::DescriptorSetLayout descriptorSetLayout = nullptr;
+	vk::raii::DescriptorSetLayout storageSetLayout = nullptr;
 
 	Pipeline() = default;
 	Pipeline(VkContext& context, vk::Format colorFormat, vk::Format depthFormat, const Config& config);
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define OSP_SIMD_SSE2 1
+#	include <emmintrin.h>
+#endif
+
+#include "vertex.h"
+
+namespace osp {
+
+// 2D cross-section swept along the track frames. Points are given in the (right, up) plane of a frame
+// and stored as SoA tables padded to a multiple of four, so a whole ring is transformed four points at a time.
+struct ProfileSection
+{
+	std::vector<float> x, y;   // point offset
+	std::vector<float> nx, ny; // outward unit normal
+	std::vector<float> u;      // texture coordinate around the section
+	std::vector<uint8_t> connectNext; // quad between point k and k + 1 (wrapping) on consecutive rings
+	int count = 0;
+
+	static ProfileSection circle(float radius, int segments)
+	{
+		ProfileSection section;
+		section.reserve(segments);
+		for (int s = 0; s < segments; s++) {
+			float angle = (float)s / segments * glm::two_pi<float>();
+			float c = glm::cos(angle);
+			float si = glm::sin(angle);
+			section.push(radius * c, radius * si, c, si, (float)s / segments, true);
+		}
+		section.pad();
+		return section;
+	}
+
+	// Hard-edged section from a counter-clockwise outline, every edge gets its own two points
+	static ProfileSection polygon(const std::vector<glm::vec2>& outline)
+	{
+		ProfileSection section;
+		section.reserve(2 * outline.size());
+
+		float perimeter = 0.0f;
+		for (size_t i = 0; i < outline.size(); i++) {
+			perimeter += glm::distance(outline[i], outline[(i + 1) % outline.size()]);
+		}
+
+		float along = 0.0f;
+		for (size_t i = 0; i < outline.size(); i++) {
+			glm::vec2 a = outline[i];
+			glm::vec2 b = outline[(i + 1) % outline.size()];
+			glm::vec2 n = glm::normalize(glm::vec2(b.y - a.y, a.x - b.x));
+			float     length = glm::distance(a, b);
+
+			section.push(a.x, a.y, n.x, n.y, along / perimeter, true);
+			along += length;
+			section.push(b.x, b.y, n.x, n.y, along / perimeter, false);
+		}
+		section.pad();
+		return section;
+	}
+
+	static ProfileSection box(float width, float height)
+	{
+		float w = 0.5f * width;
+		float h = 0.5f * height;
+		return polygon({ { -w, -h }, { w, -h }, { w, h }, { -w, h } });
+	}
+
+	static ProfileSection iBeam(float width, float height, float flangeThickness, float webThickness)
+	{
+		float w = 0.5f * width;
+		float h = 0.5f * height;
+		float f = flangeThickness;
+		float t = 0.5f * webThickness;
+		return polygon({
+			{ -w, -h },     { w, -h },     { w, -h + f }, { t, -h + f },
+			{ t, h - f },   { w, h - f },  { w, h },      { -w, h },
+			{ -w, h - f },  { -t, h - f }, { -t, -h + f },{ -w, -h + f } });
+	}
+
+private:
+	// Room for the points plus padding, so building a section allocates each table once
+	void reserve(size_t points)
+	{
+		size_t padded = (points + 3) / 4 * 4;
+		x.reserve(padded);
+		y.reserve(padded);
+		nx.reserve(padded);
+		ny.reserve(padded);
+		u.reserve(padded);
+		connectNext.reserve(padded);
+	}
+
+	void push(float px, float py, float pnx, float pny, float pu, bool connect)
+	{
+		x.push_back(px);
+		y.push_back(py);
+		nx.push_back(pnx);
+		ny.push_back(pny);
+		u.push_back(pu);
+		connectNext.push_back(connect ? 1 : 0);
+		count++;
+	}
+
+	// Padding lanes get a valid normal so the SIMD kernel never divides by zero
+	void pad()
+	{
+		while (x.size() % 4 != 0) {
+			x.push_back(0.0f);
+			y.push_back(0.0f);
+			nx.push_back(1.0f);
+			ny.push_back(0.0f);
+			u.push_back(0.0f);
+			connectNext.push_back(0);
+		}
+	}
+};
+
+// Sweeps the section along ringCount frames and writes ringCount * section.count quantized vertices.
+// Ring i is centered at positions[i] + offset.x * right + offset.y * up and gets the texture v coordinate i / ringCount.
+// Quantization follows TrackVertex::encode with origin.xyz / origin.w being the chunk origin and extent.
+inline void extrudeRings(
+	const ProfileSection& section,
+	const glm::vec3* positions, const glm::mat3* frames, size_t ringCount,
+	glm::vec2 offset, glm::vec4 origin, TrackVertex* out)
+{
+	const float q = 32767.0f / origin.w;
+	const int   n = section.count;
+
+	for (size_t i = 0; i < ringCount; i++) {
+		const glm::vec3 right = frames[i][0];
+		const glm::vec3 up = frames[i][1];
+		const glm::vec3 center = positions[i] + offset.x * right + offset.y * up;
+
+		// position quantization folded into the ring axes
+		const glm::vec3 c = (center - glm::vec3(origin)) * q;
+		const glm::vec3 r = right * q;
+		const glm::vec3 v = up * q;
+
+		const uint16_t texV = TrackVertex::quantizeUnorm((float)i / ringCount);
+		TrackVertex*   ring = out + i * n;
+
+		int k = 0;
+#if defined(OSP_SIMD_SSE2)
+		const __m128 limit = _mm_set1_ps(32767.0f);
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 zero = _mm_setzero_ps();
+
+		alignas(16) int32_t lanes[5][4];
+
+		for (; k < n; k += 4) {
+			__m128 X = _mm_loadu_ps(&section.x[k]);
+			__m128 Y = _mm_loadu_ps(&section.y[k]);
+			__m128 NX = _mm_loadu_ps(&section.nx[k]);
+			__m128 NY = _mm_loadu_ps(&section.ny[k]);
+
+			__m128 px = _mm_add_ps(_mm_set1_ps(c.x), _mm_add_ps(_mm_mul_ps(X, _mm_set1_ps(r.x)), _mm_mul_ps(Y, _mm_set1_ps(v.x))));
+			__m128 py = _mm_add_ps(_mm_set1_ps(c.y), _mm_add_ps(_mm_mul_ps(X, _mm_set1_ps(r.y)), _mm_mul_ps(Y, _mm_set1_ps(v.y))));
+			__m128 pz = _mm_add_ps(_mm_set1_ps(c.z), _mm_add_ps(_mm_mul_ps(X, _mm_set1_ps(r.z)), _mm_mul_ps(Y, _mm_set1_ps(v.z))));
+
+			__m128 wx = _mm_add_ps(_mm_mul_ps(NX, _mm_set1_ps(right.x)), _mm_mul_ps(NY, _mm_set1_ps(up.x)));
+			__m128 wy = _mm_add_ps(_mm_mul_ps(NX, _mm_set1_ps(right.y)), _mm_mul_ps(NY, _mm_set1_ps(up.y)));
+			__m128 wz = _mm_add_ps(_mm_mul_ps(NX, _mm_set1_ps(right.z)), _mm_mul_ps(NY, _mm_set1_ps(up.z)));
+
+			// octahedral encoding, see TrackVertex::octEncode
+			__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, wx), _mm_andnot_ps(signMask, wy)), _mm_andnot_ps(signMask, wz));
+			__m128 ex = _mm_div_ps(wx, l1);
+			__m128 ey = _mm_div_ps(wy, l1);
+			__m128 sx = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(ex, zero), signMask), one);
+			__m128 sy = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(ey, zero), signMask), one);
+			__m128 fx = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ey)), sx);
+			__m128 fy = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ex)), sy);
+			__m128 lower = _mm_cmplt_ps(wz, zero);
+			ex = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, ex));
+			ey = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, ey));
+
+			// rounds halfway cases away from zero like glm::round, _mm_cvtps_epi32 would round them to even
+			auto quantize = [&](__m128 value) {
+				value = _mm_min_ps(_mm_max_ps(value, _mm_sub_ps(zero, limit)), limit);
+				__m128i truncated = _mm_cvttps_epi32(value);
+				__m128  rest = _mm_andnot_ps(signMask, _mm_sub_ps(value, _mm_cvtepi32_ps(truncated)));
+				__m128  away = _mm_and_ps(_mm_cmpge_ps(rest, half), _mm_or_ps(_mm_and_ps(value, signMask), one));
+				return _mm_add_epi32(truncated, _mm_cvttps_epi32(away));
+			};
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes[0]), quantize(px));
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes[1]), quantize(py));
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes[2]), quantize(pz));
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes[3]), quantize(_mm_mul_ps(ex, limit)));
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes[4]), quantize(_mm_mul_ps(ey, limit)));
+
+			int lanesUsed = glm::min(4, n - k);
+			for (int l = 0; l < lanesUsed; l++) {
+				TrackVertex& vertex = ring[k + l];
+				vertex.pos[0] = static_cast<int16_t>(lanes[0][l]);
+				vertex.pos[1] = static_cast<int16_t>(lanes[1][l]);
+				vertex.pos[2] = static_cast<int16_t>(lanes[2][l]);
+				vertex.pos[3] = 0;
+				vertex.normal[0] = static_cast<int16_t>(lanes[3][l]);
+				vertex.normal[1] = static_cast<int16_t>(lanes[4][l]);
+				vertex.texCoord[0] = TrackVertex::quantizeUnorm(section.u[k + l]);
+				vertex.texCoord[1] = texV;
+			}
+		}
+#endif
+		for (; k < n; k++) {
+			glm::vec3 p = c + (section.x[k] * r + section.y[k] * v); // summed in the same order as the SIMD lanes
+			glm::vec3 normal = section.nx[k] * right + section.ny[k] * up;
+			glm::vec2 oct = TrackVertex::octEncode(normal);
+
+			TrackVertex& vertex = ring[k];
+			vertex.pos[0] = static_cast<int16_t>(glm::round(glm::clamp(p.x, -32767.0f, 32767.0f)));
+			vertex.pos[1] = static_cast<int16_t>(glm::round(glm::clamp(p.y, -32767.0f, 32767.0f)));
+			vertex.pos[2] = static_cast<int16_t>(glm::round(glm::clamp(p.z, -32767.0f, 32767.0f)));
+			vertex.pos[3] = 0;
+			vertex.normal[0] = TrackVertex::quantizeSnorm(oct.x);
+			vertex.normal[1] = TrackVertex::quantizeSnorm(oct.y);
+			vertex.texCoord[0] = TrackVertex::quantizeUnorm(section.u[k]);
+			vertex.texCoord[1] = texV;
+		}
+	}
+}
+
+// Appends the indices connecting consecutive rings written by extrudeRings, baseVertex being the first ring
+template <typename IndexT>
+void extrudeIndices(const ProfileSection& section, size_t ringCount, uint32_t baseVertex, std::vector<IndexT>& indices)
+{
+	const uint32_t n = section.count;
+	for (uint32_t i = 0; i + 1 < ringCount; i++) {
+		for (uint32_t k = 0; k < n; k++) {
+			if (!section.connectNext[k]) continue;
+
+			uint32_t a = baseVertex + i * n + k;
+			uint32_t b = baseVertex + i * n + (k + 1) % n;
+			uint32_t c = baseVertex + (i + 1) * n + k;
+			uint32_t d = baseVertex + (i + 1) * n + (k + 1) % n;
+
+			indices.push_back(static_cast<IndexT>(a));
+			indices.push_back(static_cast<IndexT>(c));
+			indices.push_back(static_cast<IndexT>(b));
+
+			indices.push_back(static_cast<IndexT>(b));
+			indices.push_back(static_cast<IndexT>(c));
+			indices.push_back(static_cast<IndexT>(d));
+		}
+	}
+}
+
+} // namespace osp
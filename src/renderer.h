@@ -6,6 +6,7 @@
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <limits>
@@ -50,6 +51,16 @@ import vulkan_hpp;
 #include "camera.h"
 #include "track.h"
 #include "track_mesh.h"
+#include "track_coloring.h"
+#include "train_simulation.h"
+#include "ride_analysis.h"
+#include "dispatch_simulation.h"
+#include "track_extrusion.h"
+#include "support_structures.h"
+#include "gltf_exporter.h"
+#include "track_mesh_worker.h"
+#include "track_mesh_builder.h"
+#include "upload_queue.h"
 #include "vk_context.h"
 #include "swapchain.h"
 #include "image.h"
@@ -97,11 +108,29 @@ private:
 	osp::Pipeline backgroundPipeline;
 	osp::Pipeline gridPipeline;
 	osp::Pipeline steelMaterialPipeline;
+	osp::Pipeline trackExtrusionPipeline;
+	osp::Pipeline supportPipeline;
 
 	vk::raii::DescriptorPool             descriptorPool = nullptr;
 	vk::raii::CommandPool                commandPool = nullptr;
 	std::array<osp::Frame, MAX_FRAMES_IN_FLIGHT> frames;
 	uint32_t                         currentFrame = 0;
+	uint64_t                         submittedFrames = 0;
+	osp::UploadQueue                 uploads; // track meshes and supports, streamed without waiting for the queue
+
+	// Meshes replaced while frames drawing them may still be in flight, freed once those have finished
+	struct RetiredMesh {
+		uint64_t                        submittedFrames; // when it was replaced, later frames don't draw it
+		std::unique_ptr<osp::TrackMesh> mesh;
+	};
+	std::deque<RetiredMesh> retiredMeshes;
+
+	// Support instance buffers replaced the same way
+	struct RetiredBuffer {
+		uint64_t           submittedFrames;
+		osp::StorageBuffer buffer;
+	};
+	std::deque<RetiredBuffer> retiredBuffers;
 
 	bool framebufferResized = false;
 
@@ -113,11 +142,14 @@ private:
 	uint32_t lastHoveredControlPointIndex = 0;
 
 	osp::Camera camera;
-	std::unique_ptr<osp::Mesh> groundGridMesh;
 
 	std::unique_ptr<osp::Track> track;
 	std::unique_ptr<osp::TrackMesh> trackMesh;
 	std::unique_ptr<osp::TrackMesh> trackWireframeMesh;
+	std::unique_ptr<osp::TrackExtrusion> trackExtrusion;
+	osp::SupportStructures supports;
+	osp::TrackMeshWorker meshWorker;
+	osp::TrackMeshBuilder meshBuilder;
 	bool trackDirty = false;
 
 	osp::NodeEditor nodeEditor;
@@ -127,16 +159,31 @@ private:
 
 	bool showAbout = false;
 	bool onlyShowWireframe = false;
+	bool gpuExtrusion = false; // build the track in the vertex shader from uploaded frames
+	bool timeSlicedMeshing = false; // rebuild on the render thread within meshBudgetMs per frame instead of the worker
+	float meshBudgetMs = 2.0f;
+	osp::LinearArena::Stats meshArenaStats; // temporaries of the last full rebuild
+
+	osp::TrackColoring coloring;
+	bool               coloringDirty = false; // recolour pending, after a run reached the end or while the builder runs
+	bool               supportsDirty = false; // regenerated once per frame in drawFrame()
+	bool showSupports = true;
 
 	// PHYSICS
-	float dt = 0.016666;
-	float rollingFriction = 0.001f;
-	float dragCoeff = 0.0f; //0.0025f; // tweak this
+	osp::TrainSimulation simulation;
 	float u = 0.0f;
-	float s = 0.0f;
+	float s = 0.0f; // interpolated train state of the current frame
 	float v = 0.0f;
+	float rideTime = 0.0f; // seconds since the run started, scrubbed through the simulation's checkpoints
+	bool  trainAtEnd = false;
+	uint64_t recordedCommand = 0; // TrainSimulation command the speeds were last recorded in
 
 	bool doSimulate = true;
+	osp::RideAnalysis rideAnalysis;
+	bool showRideAnalysis = false;
+	osp::DispatchSimulation dispatch;
+	osp::DispatchSimulation::Report capacity;
+	osp::TrainIntegrator::Method integratorMethod = osp::TrainIntegrator::Method::DormandPrince;
 
 	void initWindow()
 	{
@@ -279,11 +326,30 @@ private:
 		swapChain = osp::Swapchain(context, *context.surface, window);
 		mainPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
 			.shaderPath = "shaders/main_shader.spv",
-			.polygonMode = vk::PolygonMode::eLine}
+			.topology = vk::PrimitiveTopology::eLineList,
+			.polygonMode = vk::PolygonMode::eFill,
+			.vertexFormat = osp::Pipeline::VertexFormat::Track,
+			.pushConstantSize = sizeof(osp::TrackMesh::DrawConstants) }
 		);
 		steelMaterialPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
 			.shaderPath = "shaders/steel_material_shader.spv",
-			.polygonMode = vk::PolygonMode::eFill }
+			.polygonMode = vk::PolygonMode::eFill,
+			.vertexFormat = osp::Pipeline::VertexFormat::Track,
+			.pushConstantSize = sizeof(osp::TrackMesh::DrawConstants) }
+		);
+		trackExtrusionPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
+			.shaderPath = "shaders/track_extrusion.spv",
+			.polygonMode = vk::PolygonMode::eFill,
+			.hasVertexInput = false,
+			.pushConstantSize = sizeof(osp::TrackExtrusion::DrawConstants),
+			.vertexStorageBuffer = true }
+		);
+		supportPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
+			.shaderPath = "shaders/support_shader.spv",
+			.polygonMode = vk::PolygonMode::eFill,
+			.hasVertexInput = false,
+			.pushConstantSize = sizeof(osp::SupportStructures::DrawConstants),
+			.vertexStorageBuffer = true }
 		);
 		backgroundPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
 			.shaderPath = "shaders/horizon_gradient.spv",
@@ -294,11 +360,12 @@ private:
 		);
 		gridPipeline = osp::Pipeline(context, swapChain.surfaceFormat.format, osp::findDepthFormat(context), {
 			.shaderPath = "shaders/ground_grid.spv",
-			.polygonMode = vk::PolygonMode::eLine,}
+			.polygonMode = vk::PolygonMode::eFill,
+			.hasVertexInput = false }
 		);
 		createCommandPool();
+		uploads.init(context, commandPool);
 		renderAttachments = osp::RenderAttachments(context, swapChain.extent, swapChain.surfaceFormat.format);
-		createGroundGrid();
 		createDescriptorPool();
 		createFrameResources();
 	}
@@ -377,10 +444,43 @@ private:
 		track = std::make_unique<osp::Track>();
 		track->load(std::string(filePath));
 		trackDirty = true;
+		supports.invalidate();
+		coloring.resetRecording(track->totalLength());
+
+		moveTrain(0.0f, 0.001f);
+	}
+
+	void moveTrain(float arcLength, float speed)
+	{
+		s = arcLength;
+		v = speed;
+		u = track ? track->curve->arcLengthToNormalized(s) : 0.0f;
+		simulation.moveTo(s, v);
+	}
+
+	// Takes the train state for this frame from the simulation thread and records its speed for colouring
+	void updateTrain()
+	{
+		osp::TrainSimulation::State state = simulation.sample();
 
-		u = 0.0f;
-		s = 0.0f;
-		v = 0.001f;
+		// the train jumps with every moveTo() and seekTo(), a new command starts a new stretch of recording
+		if (!state.waiting) {
+			if (state.command == recordedCommand) coloring.record(s, v, state.s, state.v);
+			else coloring.record(state.s, state.v, state.s, state.v);
+			recordedCommand = state.command;
+		}
+
+		// recolour once a run has reached the end, in the modes recorded from it
+		bool recorded = coloring.mode == osp::TrackColoring::Mode::Speed || coloring.mode == osp::TrackColoring::Mode::GForce;
+		if (state.atEnd && !trainAtEnd && recorded) {
+			coloringDirty = true;
+		}
+		trainAtEnd = state.atEnd;
+
+		s = state.s;
+		v = state.v;
+		rideTime = static_cast<float>(state.runTime);
+		u = track->curve->arcLengthToNormalized(s);
 	}
 
 	void saveTrack(std::string filePath)
@@ -392,6 +492,183 @@ private:
 		track->save(filePath);
 	}
 
+	// Exports the shown mesh, or meshes the track just for the export when it is built on the GPU or still being built
+	void exportTrack(std::string filePath)
+	{
+		std::unique_ptr<osp::TrackMesh> exportMesh;
+		const osp::TrackMesh* mesh = trackMesh.get();
+		if (!mesh || meshBuilder.active() || meshWorker.pending()) {
+			if (track->transportFrames.empty()) {
+				track->precomputeTransportFrames();
+			}
+			exportMesh = std::make_unique<osp::TrackMesh>();
+			exportMesh->track = track.get();
+			exportMesh->generateMesh();
+			mesh = exportMesh.get();
+		}
+
+		osp::GltfExporter exporter;
+		exporter.trackColor = mesh->color;
+		exporter.supportColor = supports.color;
+		try {
+			exporter.exportGlb(filePath, *mesh, showSupports ? &supports : nullptr);
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+		}
+	}
+
+	// Simulates the whole ride and shows the forces on the riders, kept up to date while the window is open
+	void analyzeRide()
+	{
+		if (track->transportFrames.empty()) {
+			track->precomputeTransportFrames();
+		}
+		if (track->slopes.empty()) {
+			track->updateSlopes();
+		}
+		rideAnalysis.analyze(*track);
+		showRideAnalysis = true;
+	}
+
+	void refreshRideAnalysis()
+	{
+		if (showRideAnalysis) {
+			rideAnalysis.analyze(*track);
+		}
+	}
+
+	// The time series goes to filePath, the extremes per segment next to it
+	void exportRideAnalysis(std::string filePath)
+	{
+		std::filesystem::path seriesPath(filePath);
+		std::filesystem::path elementsPath = seriesPath;
+		elementsPath.replace_filename(seriesPath.stem().string() + "_elements.csv");
+
+		std::ofstream series(seriesPath);
+		rideAnalysis.writeSeriesCsv(series);
+		std::ofstream elements(elementsPath);
+		rideAnalysis.writeElementsCsv(elements);
+	}
+
+	void showRideAnalysisWindow()
+	{
+		if (!ImGui::Begin("Ride Analysis", &showRideAnalysis, ImGuiWindowFlags_AlwaysAutoResize)) {
+			ImGui::End();
+			return;
+		}
+
+		const osp::RideAnalysis::Element& ride = rideAnalysis.ride;
+		float duration = rideAnalysis.samples.size() > 0 ? rideAnalysis.samples.t.back() : 0.0f;
+		ImGui::Text("%s after %.1f s at %.1f m (%.2f ms)", rideAnalysis.completed ? "Completed" : "Stalled", duration, ride.sEnd, rideAnalysis.milliseconds);
+		ImGui::Text("Vertical %.2f to %.2f g, lateral %.2f g, longitudinal %.2f to %.2f g", ride.minVertical, ride.maxVertical, ride.maxLateral, ride.minLongitudinal, ride.maxLongitudinal);
+		ImGui::Text("Jerk up to %.1f g/s, top speed %.1f m/s, %zu airtime regions for %.2f s", ride.maxJerk, ride.maxSpeed, rideAnalysis.airtime.size(), ride.airtime);
+
+		const osp::RideAnalysis::Series& series = rideAnalysis.series;
+		int count = static_cast<int>(series.t.size());
+		ImGui::PlotLines("Vertical g", series.vertical.data(), count, 0, nullptr, ride.minVertical, ride.maxVertical, ImVec2(400.0f, 60.0f));
+		ImGui::PlotLines("Lateral g", series.lateral.data(), count, 0, nullptr, -ride.maxLateral, ride.maxLateral, ImVec2(400.0f, 60.0f));
+		ImGui::PlotLines("Speed", series.v.data(), count, 0, nullptr, 0.0f, ride.maxSpeed, ImVec2(400.0f, 60.0f));
+
+		if (ImGui::CollapsingHeader("Segments")) {
+			for (const osp::RideAnalysis::Element& e : rideAnalysis.elements) {
+				ImGui::Text("%3u  %6.1f - %6.1f m  vertical %5.2f to %5.2f g  lateral %4.2f g  jerk %5.1f g/s", e.segment, e.sBegin, e.sEnd, e.minVertical, e.maxVertical, e.maxLateral, e.maxJerk);
+			}
+		}
+		ImGui::End();
+	}
+
+	// Zones don't change the shape, so the track is only handed to the simulation and recolored
+	void updateZones()
+	{
+		track->zones.build();
+		simulation.setTrack(std::make_unique<osp::Track>(*track));
+		if (coloring.mode == osp::TrackColoring::Mode::PredictedSpeed) {
+			recolorTrack();
+		}
+		refreshRideAnalysis();
+	}
+
+	void showZoneEditor()
+	{
+		bool   changed = false;
+		float  length = track->totalLength();
+		std::vector<osp::TrackZone>& zones = track->zones.zones;
+		for (size_t i = 0; i < zones.size(); i++) {
+			osp::TrackZone& zone = zones[i];
+			ImGui::PushID(static_cast<int>(i));
+			int type = static_cast<int>(zone.type);
+			ImGui::SetNextItemWidth(120.0f);
+			if (ImGui::Combo("##type", &type, osp::TrackZone::TYPE_NAMES.data(), static_cast<int>(osp::TrackZone::TYPE_NAMES.size()))) {
+				zone.type = static_cast<osp::TrackZone::Type>(type);
+				changed = true;
+			}
+			ImGui::SameLine();
+			ImGui::SetNextItemWidth(140.0f);
+			changed |= ImGui::DragFloatRange2("##range", &zone.start, &zone.end, 0.1f, 0.0f, length, "%.1f m");
+			ImGui::SameLine();
+			ImGui::SetNextItemWidth(80.0f);
+			changed |= ImGui::DragFloat("##speed", &zone.speed, 0.1f, 0.0f, 100.0f, "%.1f m/s");
+			if (zone.type != osp::TrackZone::Type::Lift) {
+				ImGui::SameLine();
+				ImGui::SetNextItemWidth(80.0f);
+				changed |= ImGui::DragFloat("##force", &zone.force, 0.05f, 0.0f, 50.0f, zone.type == osp::TrackZone::Type::MagneticBrake ? "%.2f 1/s" : "%.2f m/s2");
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Remove")) {
+				zones.erase(zones.begin() + i);
+				changed = true;
+				ImGui::PopID();
+				break;
+			}
+			ImGui::PopID();
+		}
+		if (ImGui::Button("Add Zone")) {
+			float start = zones.empty() ? 0.0f : std::min(zones.back().end, length);
+			zones.push_back({ osp::TrackZone::Type::BlockBrake, start, std::min(start + 10.0f, length), 0.0f, 3.0f });
+			changed = true;
+		}
+		if (changed) {
+			updateZones();
+		}
+	}
+
+	void showCapacity()
+	{
+		int trainCount = static_cast<int>(dispatch.settings.trainCount);
+		ImGui::SetNextItemWidth(80.0f);
+		if (ImGui::InputInt("Trains", &trainCount)) {
+			dispatch.settings.trainCount = static_cast<uint32_t>(std::clamp(trainCount, 1, 32));
+		}
+		ImGui::SameLine();
+		int carCount = static_cast<int>(dispatch.settings.physics.train.carCount);
+		ImGui::SetNextItemWidth(80.0f);
+		if (ImGui::InputInt("Cars", &carCount)) {
+			dispatch.settings.physics.train.carCount = static_cast<uint32_t>(std::clamp(carCount, 1, static_cast<int>(osp::TrainModel::MAX_CARS)));
+		}
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(80.0f);
+		ImGui::DragFloat("Dwell", &dispatch.settings.dwell, 0.5f, 0.0f, 300.0f, "%.0f s");
+		ImGui::SameLine();
+		if (ImGui::Button("Estimate")) {
+			if (track->slopes.empty()) {
+				track->updateSlopes();
+			}
+			capacity = dispatch.run(*track);
+		}
+		if (capacity.simulatedSeconds <= 0.0) return;
+
+		if (capacity.stuck) {
+			ImGui::Text("A train gets stuck at %.1f m (%.1f ms)", capacity.stuckS, capacity.milliseconds);
+			return;
+		}
+		ImGui::Text("%.0f riders per hour, %u dispatches in %.0f s (%.1f ms)", capacity.ridersPerHour, capacity.dispatches, capacity.simulatedSeconds, capacity.milliseconds);
+		ImGui::Text("Waiting to dispatch %.0f s, %u trains stacked for %.0f s", capacity.dispatchDelay, capacity.stacked, capacity.stackedSeconds);
+		for (const osp::DispatchSimulation::Block& block : capacity.blocks) {
+			ImGui::Text("%6.1f - %6.1f m  %3.0f%% occupied  %u stops for %.0f s  %u overruns", block.start, block.end, 100.0 * capacity.utilization(block), block.stops, block.stoppedSeconds, block.overruns);
+		}
+	}
+
 	void createNewTrack()
 	{
 		currentTrackFilePath = "NewTrack";
@@ -400,10 +677,9 @@ private:
 		track = std::make_unique<osp::Track>();
 		track->createEmpty();
 		trackDirty = true;
+		supports.invalidate();
 
-		u = 0.0f;
-		s = 0.0f;
-		v = 0.0f;
+		moveTrain(0.0f, 0.0f);
 	}
 
 	void initWorld() 
@@ -418,65 +694,12 @@ private:
 
 		nodeEditor.camera = &camera;
 		nodeEditor.trackDirty = &trackDirty;
+		nodeEditor.moveTrain = [this](float arcLength) { moveTrain(arcLength, 0.0f); };
 
 		camera.updateProj(window, 0.0f);
 		camera.updateView(window, 0.0f);
 	}
 
-	void doPhysics(double dt)
-	{
-		auto& curve = *track->curve;
-
-		float remainingTime = (float)dt;
-		float dtSub = 0.001f; // max substep
-
-		float totalLength = curve.totalLength();
-
-		while (remainingTime > 0) {
-			float step = std::min(dtSub, remainingTime);
-
-			glm::vec3 pos = curve.evaluate(s);
-
-			// Clamp end
-			if (s >= totalLength)
-			{
-				v = 0;
-				return;
-			}
-			glm::vec3 tangent = glm::normalize(curve.getTangentAtLength(s));
-
-			float a = 9.81f * glm::dot(GRAVITY, tangent);
-			
-			float frictionAccel = 0.0f; 
-			if (v > 0.00001f || v < -0.00001f)
-			{
-				frictionAccel = -rollingFriction * 9.81f * glm::sign(v);
-			}
-			a += frictionAccel;
-
-			float dragAccel = -dragCoeff * v * fabs(v); // v^2 with direction
-			a += dragAccel;
-
-			// Euler integration
-			float oldV = v;
-			v = oldV + a * step;
-			s += 0.5f * (v + oldV) * step;
-			//s += v * step + 0.5f * a * step * step;
-			//v += a * step;
-
-			// Clamp s to track
-			if (s < 0) { s = 0; v = 0; }
-			if (s > totalLength) { s = totalLength; v = 0; }
-
-			if (s <= 30.0f) 
-			{
-				v = glm::max(2.5f, v);
-			}
-
-			remainingTime -= step;
-		}
-	}
-
 	void mainLoop()
 	{
 		ImGuizmo::AllowAxisFlip(false);
@@ -529,6 +752,32 @@ private:
 							NFD_FreePathU8(savePath);
 						}
 					}
+					if (ImGui::MenuItem("Export Ride Analysis...", nullptr, false, track != nullptr && !rideAnalysis.series.t.empty()))
+					{
+						nfdu8char_t* exportPath = NULL;
+						nfdu8filteritem_t filters[1] = { { "CSV", "csv" } };
+						nfdsavedialogu8args_t args = { 0 };
+						args.filterList = filters;
+						args.filterCount = 1;
+						nfdresult_t result = NFD_SaveDialogU8_With(&exportPath, &args);
+						if (result == NFD_OKAY) {
+							exportRideAnalysis(exportPath);
+							NFD_FreePathU8(exportPath);
+						}
+					}
+					if (ImGui::MenuItem("Export glTF...", nullptr, false, track != nullptr))
+					{
+						nfdu8char_t* exportPath = NULL;
+						nfdu8filteritem_t filters[1] = { { "glTF Binary", "glb" } };
+						nfdsavedialogu8args_t args = { 0 };
+						args.filterList = filters;
+						args.filterCount = 1;
+						nfdresult_t result = NFD_SaveDialogU8_With(&exportPath, &args);
+						if (result == NFD_OKAY) {
+							exportTrack(exportPath);
+							NFD_FreePathU8(exportPath);
+						}
+					}
 					ImGui::Separator();
 					if (ImGui::MenuItem("Exit"))
 					{
@@ -553,7 +802,7 @@ private:
 			}
 
 			ImGuiIO& io = ImGui::GetIO();
-			ImVec2 winSize(400.0f, 50.0f);
+			ImVec2 winSize(400.0f, 160.0f);
 			ImVec2 pos = ImVec2(0.0f, io.DisplaySize.y - winSize.y);
 
 			ImGui::SetNextWindowPos(pos, ImGuiCond_Always);
@@ -627,26 +876,113 @@ private:
 				showTranslateOnHover();
 				ImGui::Begin("Track Controls", nullptr, flags);
 
+				updateTrain();
 				if (ImGui::SliderFloat("Arc Length", &s, 0.0f, track->totalLength()))
 				{
-					//s = track->curve->normalizedToArcLength(u);
-					v = 0;
+					moveTrain(s, 0.0f);
 				}
-				else
+				// past the recorded part the run is simulated ahead, up to the end once that is known
+				float rideEnd = std::max(static_cast<float>(simulation.recordedTime()), rideTime) + (trainAtEnd ? 0.0f : 10.0f);
+				if (ImGui::SliderFloat("Ride Time", &rideTime, 0.0f, rideEnd, "%.2f s"))
 				{
-					if (doSimulate)
-					{
-						float physicsDt = std::min((float)timeDiff, dt);
-						doPhysics(physicsDt);
-					}
-					u = track->curve->arcLengthToNormalized(s);
+					simulation.seekTo(rideTime);
 				}
 				//ImGui::Text("Segment: %i", track->curve->getSegmentAtLength(s));
-				ImGui::Checkbox("Simulate Physics", &doSimulate);
+				if (ImGui::Checkbox("Simulate Physics", &doSimulate)) {
+					simulation.setRunning(doSimulate);
+				}
+				ImGui::SameLine();
+				ImGui::SetNextItemWidth(100.0f);
+				int colorMode = static_cast<int>(coloring.mode);
+				if (ImGui::Combo("Color By", &colorMode, osp::TrackColoring::MODE_NAMES.data(), static_cast<int>(osp::TrackColoring::MODE_NAMES.size()))) {
+					coloring.mode = static_cast<osp::TrackColoring::Mode>(colorMode);
+					recolorTrack();
+				}
+				if (coloring.mode != osp::TrackColoring::Mode::None) {
+					ImGui::SameLine();
+					ImGui::Text("%.1f to %.1f", coloring.minValue, coloring.maxValue);
+				}
+				if (coloring.mode == osp::TrackColoring::Mode::PredictedSpeed) {
+					ImGui::SameLine();
+					if (coloring.profile.completed) {
+						ImGui::Text("(%.1f s ride, %.0f us)", coloring.profile.timeAt(coloring.profile.stallS), coloring.profile.microseconds);
+					}
+					else {
+						ImGui::Text("(stalls at %.1f m, %.0f us)", coloring.profile.stallS, coloring.profile.microseconds);
+					}
+				}
+				ImGui::SetNextItemWidth(130.0f);
+				int method = static_cast<int>(integratorMethod);
+				if (ImGui::Combo("Integrator", &method, osp::TrainIntegrator::METHOD_NAMES.data(), static_cast<int>(osp::TrainIntegrator::METHOD_NAMES.size()))) {
+					integratorMethod = static_cast<osp::TrainIntegrator::Method>(method);
+					simulation.setMethod(integratorMethod);
+				}
+				ImGui::SameLine();
+				const osp::TrainIntegrator::Stats& integratorStats = simulation.integratorStats();
+				ImGui::Text("%llu steps (%llu rejected), %llu evaluations, error %.1e m", (unsigned long long)integratorStats.steps,
+					(unsigned long long)integratorStats.rejected, (unsigned long long)integratorStats.evaluations, integratorStats.errorBound);
+				if (ImGui::Button("Analyze Ride")) {
+					analyzeRide();
+				}
+				if (ImGui::CollapsingHeader("Zones")) {
+					showZoneEditor();
+				}
+				if (ImGui::CollapsingHeader("Capacity")) {
+					showCapacity();
+				}
+				if (ImGui::Checkbox("GPU Extrusion", &gpuExtrusion)) {
+					trackDirty = true;
+				}
+				ImGui::SameLine();
+				ImGui::Checkbox("Time-Sliced Meshing", &timeSlicedMeshing);
+				if (timeSlicedMeshing) {
+					ImGui::SameLine();
+					ImGui::SetNextItemWidth(80.0f);
+					ImGui::SliderFloat("ms", &meshBudgetMs, 0.5f, 8.0f, "%.1f");
+				}
+				if (ImGui::Checkbox("Supports", &showSupports)) {
+					updateSupports();
+				}
+				if (showSupports) {
+					ImGui::SameLine();
+					ImGui::SetNextItemWidth(80.0f);
+					if (ImGui::SliderFloat("Spacing", &supports.settings.spacing, 2.0f, 20.0f, "%.1f m")) {
+						updateSupports();
+					}
+					ImGui::SameLine();
+					ImGui::Text("%u columns, %u braces (%.1f ms)", supports.stats.columns, supports.stats.braces, supports.stats.milliseconds);
+				}
+				if (nodeEditor.trackHover.valid()) {
+					ImGui::Text("Track %.1f m (%.1f us): Shift+Click train, Ctrl+Click node", nodeEditor.trackHover.s, nodeEditor.pickMicroseconds);
+				}
+				else {
+					ImGui::Text("Hover the track to pick a position");
+				}
+				if (gpuExtrusion && trackExtrusion && !onlyShowWireframe) {
+					ImGui::Text("Uploaded frames: %zu (%u vertices)", trackExtrusion->samples.size(), trackExtrusion->vertexCount());
+				}
+				else if (meshWorker.pending()) {
+					ImGui::Text("Meshing...");
+				}
+				else if (meshBuilder.active() && meshBuilder.built.empty()) {
+					ImGui::Text("Updating track...");
+				}
+				else if (meshBuilder.active()) {
+					ImGui::Text("Meshing... %zu / %zu chunks", meshBuilder.builtCount(), meshBuilder.built.size());
+				}
+				else if (trackMesh && !onlyShowWireframe) {
+					ImGui::Text("Index ACMR: %.3f -> %.3f", trackMesh->indexStats.acmrBefore, trackMesh->indexStats.acmrAfter);
+					ImGui::Text("Scratch: %zu allocs, %zu from heap, %.1f MB peak", meshArenaStats.allocations, meshArenaStats.upstreamAllocations, meshArenaStats.bytesUsed / 1048576.0);
+					ImGui::Text("Chunks drawn: %u / %zu", trackMesh->visibleChunks, trackMesh->chunks.size());
+				}
 
 				ImGui::End();
 
-				if (trackMesh || trackWireframeMesh)
+				if (showRideAnalysis) {
+					showRideAnalysisWindow();
+				}
+
+				if (trackMesh || trackWireframeMesh || trackExtrusion)
 				{
 					//ImDrawList* drawList = ImGui::GetForegroundDrawList();
 					//size_t numControlPoints = track->curve->getNumControlPoints();
@@ -659,17 +995,25 @@ private:
 
 					glm::mat4 proj(camera.proj);
 					proj[1][1] *= -1;
-					glm::mat4 frenet = track->evaluateFrenet(s);
+					const osp::TrainModel& train = simulation.train();
+					std::array<glm::mat4, osp::TrainModel::MAX_CARS> cars;
+					train.carPoses(*track, s, cars.data());
+
+					// one box per car, stretched along the track
 					glm::mat4 model = 0.9f * glm::identity<glm::mat4>();
+					model[2][2] = 0.45f * train.carLength;
 					model[3][3] = 1.0f;
 					model[3][1] += 0.5f;
-					model = frenet * model;
 					glm::mat4 id = glm::identity<glm::mat4>();
 					if (camera.userControlled) {
+						for (uint32_t i = 0; i < train.carCount; i++) {
+							cars[i] = cars[i] * model;
+						}
 						// ROLL SEEMS TO INFLUENCE TOO MUCH
-						ImGuizmo::DrawCubes(glm::value_ptr(camera.view), glm::value_ptr(proj), glm::value_ptr(model), 1);
+						ImGuizmo::DrawCubes(glm::value_ptr(camera.view), glm::value_ptr(proj), glm::value_ptr(cars[0]), static_cast<int>(train.carCount));
 					} else {
-						glm::mat4 frenet = track->evaluateFrenet(s);
+						// riding in the first car
+						glm::mat4 frenet = cars[0];
 
 						// extract frame axes
 						glm::vec3 right = glm::vec3(frenet[0]);
@@ -795,74 +1139,180 @@ private:
 
 	void createTrack()
 	{
-		for (auto& frame : frames) {
-			while (vk::Result::eTimeout == context.device.waitForFences(*frame.inFlight, vk::True, UINT64_MAX));
+		nodeEditor.track = track.get();
+		trackDirty = false;
+		coloring.fitRecording(track->totalLength());
+		simulation.setTrack(std::make_unique<osp::Track>(*track));
+
+		if (gpuExtrusion && !onlyShowWireframe) {
+			meshWorker.cancel();
+			waitForFrames();
+			meshBuilder.cancel();
+			track->update();
+
+			// no CPU meshing, only the frames are uploaded
+			trackMesh.reset();
+			if (!trackExtrusion) {
+				trackExtrusion = std::make_unique<osp::TrackExtrusion>();
+			}
+			trackExtrusion->track = track.get();
+			trackExtrusion->generateSamples();
+			trackExtrusion->upload(context, commandPool, descriptorPool, *trackExtrusionPipeline.storageSetLayout);
+			updateSupports();
+			refreshRideAnalysis();
+			return;
 		}
 
-		auto& viewedMesh = onlyShowWireframe ? trackWireframeMesh : trackMesh;
-		viewedMesh = std::make_unique<osp::TrackMesh>();
-		viewedMesh->track = track.get();
+		if (meshBuilder.active()) {
+			// its chunks may be drawn by frames still in flight
+			retireMesh(meshBuilder.cancel());
+		}
+
+		if (timeSlicedMeshing && !onlyShowWireframe) {
+			meshWorker.cancel();
 
-		track->update();
-		if (onlyShowWireframe) {
-			trackWireframeMesh->generateWireframeMesh();
-			trackWireframeMesh->upload(context, commandPool);
+			// the track itself is updated within the budget too, see advanceTrackMesh()
+			std::vector<glm::vec3> focusPoints = { camera.position };
+			if (nodeEditor.selected) {
+				focusPoints.push_back(nodeEditor.selected->position);
+			}
+			meshBuilder.coloring = &coloring;
+			meshBuilder.start(track.get(), focusPoints);
+			return;
 		}
-		else {
-			trackMesh->generateMesh();
-			trackMesh->upload(context, commandPool);
+
+		// a freshly loaded track has no frames until its first mesh comes back
+		if (track->transportFrames.empty()) {
+			track->precomputeTransportFrames();
+		}
+
+		// meshed on the worker, the current mesh stays on screen until adoptTrackMesh()
+		meshWorker.submit(std::make_unique<osp::Track>(*track), onlyShowWireframe);
+	}
+
+	void waitForFrames()
+	{
+		for (auto& frame : frames) {
+			while (vk::Result::eTimeout == context.device.waitForFences(*frame.inFlight, vk::True, UINT64_MAX));
 		}
-		nodeEditor.track = track.get();
-		trackDirty = false;
 	}
 
-	void createGroundGrid()
+	void advanceTrackMesh()
 	{
-		groundGridMesh = std::make_unique<osp::Mesh>();
+		bool trackWasUpdated = meshBuilder.trackUpdated();
+		bool done = meshBuilder.advance(uploads, meshBudgetMs);
+		if (!trackWasUpdated && meshBuilder.trackUpdated()) {
+			// before the builder colors its first chunk
+			if (coloring.mode != osp::TrackColoring::Mode::None) {
+				coloring.evaluate(*track);
+			}
+			updateSupports();
+			refreshRideAnalysis();
+		}
+		if (!done) return;
 
-		std::vector<osp::Vertex>& vertices = groundGridMesh->data.vertices;
-		std::vector<uint32_t>& indices = groundGridMesh->data.indices;
+		meshArenaStats = meshBuilder.arenaStats();
+		if (trackMesh) recycleBvh(*trackMesh);
+		retireMesh(std::move(trackMesh));
+		trackMesh = meshBuilder.finish();
+		trackExtrusion.reset();
+	}
 
-		glm::vec3 color{ 10.0f, 10.0f, 10.0f };
-		color /= 256.0f;
-		float gridHalfSize = 2000.0f;
-		float spacing = 1.0f;
-		const int lineCount = static_cast<int>((gridHalfSize * 2.0f) / spacing) + 1;
+	// The next rebuild refits the picking tree of the replaced mesh, where the track moved, instead of building its own
+	void recycleBvh(osp::TrackMesh& replaced)
+	{
+		if (timeSlicedMeshing) meshBuilder.recycle(std::move(replaced.bvh));
+		else meshWorker.recycle(std::move(replaced.bvh));
+	}
 
-		uint32_t index = 0;
+	// Keeps a replaced mesh until the frames submitted so far, which may draw it, have finished
+	void retireMesh(std::unique_ptr<osp::TrackMesh> mesh)
+	{
+		if (mesh) retiredMeshes.push_back({ submittedFrames, std::move(mesh) });
+	}
 
-		for (int i = 0; i < lineCount; ++i)
-		{
-			float pos = -gridHalfSize + i * spacing;
+	// Frees the retired meshes and buffers no frame in flight can still be drawing, after the current frame's fence was waited for
+	void freeRetired()
+	{
+		const uint64_t stillRunning = MAX_FRAMES_IN_FLIGHT - 1;
+		uint64_t finished = submittedFrames > stillRunning ? submittedFrames - stillRunning : 0;
+		while (!retiredMeshes.empty() && retiredMeshes.front().submittedFrames <= finished) {
+			retiredMeshes.pop_front();
+		}
+		while (!retiredBuffers.empty() && retiredBuffers.front().submittedFrames <= finished) {
+			retiredBuffers.pop_front();
+		}
+	}
 
-			// Line parallel to X axis (along Z)
-			vertices.push_back({{ -gridHalfSize, 0.0f, pos }, color, { 0.0f, 0.0f }, UP_DIR});
-			vertices.push_back({{  gridHalfSize, 0.0f, pos }, color, { 0.0f, 0.0f }, UP_DIR });
+	void adoptTrackMesh(osp::TrackMeshWorker::Result& result)
+	{
+		result.mesh->track = track.get();
+		track->transportFrames = std::move(result.track->transportFrames);
+		track->slopes = std::move(result.track->slopes);
+		refreshRideAnalysis();
+		if (coloring.mode != osp::TrackColoring::Mode::None) {
+			coloring.evaluate(*track);
+			result.mesh->applyColoring(coloring);
+		}
 
-			indices.push_back(index++);
-			indices.push_back(index++);
-			indices.push_back(index-1);
+		// drawn from the next frame on, the copies are ordered before it on the queue
+		result.mesh->upload(uploads);
+		uploads.submit();
 
-			// Line parallel to Z axis (along X)
-			vertices.push_back({ { pos, 0.0f, -gridHalfSize }, color, { 0.0f, 0.0f }, UP_DIR });
-			vertices.push_back({ { pos, 0.0f, gridHalfSize }, color, { 0.0f, 0.0f }, UP_DIR });
+		if (!result.wireframe) meshArenaStats = result.arenaStats;
 
-			indices.push_back(index++);
-			indices.push_back(index++);
-			indices.push_back(index-1);
+		auto& viewedMesh = result.wireframe ? trackWireframeMesh : trackMesh;
+		if (viewedMesh && !result.wireframe) recycleBvh(*viewedMesh);
+		retireMesh(std::move(viewedMesh));
+		viewedMesh = std::move(result.mesh);
+		trackExtrusion.reset();
+		updateSupports();
+	}
+
+	// Rewrites only the attribute stream of the shown meshes, the geometry stays as it is
+	void recolorTrack()
+	{
+		// chunks the builder already colored would keep the old colors, so it waits for the builder
+		coloringDirty = true;
+		if (!track || meshBuilder.active()) return;
+
+		coloring.evaluate(*track);
+		for (osp::TrackMesh* mesh : { trackMesh.get(), trackWireframeMesh.get() }) {
+			if (!mesh) continue;
+			mesh->applyColoring(coloring);
+			mesh->uploadAttributes(uploads);
 		}
+		uploads.submit();
+		coloringDirty = false;
+	}
 
-		groundGridMesh->upload(context, commandPool);
+	// Regenerates the supports around the edited part of the track in drawFrame(), needs the current transport frames
+	void updateSupports()
+	{
+		supportsDirty = showSupports && track;
+	}
+
+	// At most once per frame, so no more than MAX_FRAMES_IN_FLIGHT replaced buffers are alive
+	void regenerateSupports()
+	{
+		supportsDirty = false;
+		supports.generate(*track);
+
+		// drawn from the next frame on, the one it replaces stays until the frames before have finished
+		osp::StorageBuffer replaced = supports.upload(uploads, context, descriptorPool, *supportPipeline.storageSetLayout);
+		uploads.submit();
+		retiredBuffers.push_back({ submittedFrames, std::move(replaced) });
 	}
 
 	void createDescriptorPool()
 	{
 		std::array poolSize{
 			vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, MAX_FRAMES_IN_FLIGHT),
-			vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, MAX_FRAMES_IN_FLIGHT), };
+			vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, MAX_FRAMES_IN_FLIGHT),
+			vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, MAX_FRAMES_IN_FLIGHT + 2), };
 		vk::DescriptorPoolCreateInfo poolInfo{
 			.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-			.maxSets = MAX_FRAMES_IN_FLIGHT,
+			.maxSets = 2 * MAX_FRAMES_IN_FLIGHT + 2, // frames, the track extrusion, the supports and their retired buffers
 			.poolSizeCount = static_cast<uint32_t>(poolSize.size()),
 			.pPoolSizes = poolSize.data() };
 		descriptorPool = vk::raii::DescriptorPool(context.device, poolInfo);
@@ -924,28 +1374,79 @@ private:
 
 		// Draw Ground
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *gridPipeline.pipeline);
-		cmd.bindVertexBuffers(0, *groundGridMesh->vertexBuffer.buffer, { 0 });
 		cmd.setDepthTestEnable(true);
-		cmd.bindIndexBuffer(*groundGridMesh->indexBuffer.buffer, 0, vk::IndexType::eUint32);
 		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *gridPipeline.pipelineLayout, 0, *frames[currentFrame].descriptorSet, nullptr);
-		cmd.drawIndexed(groundGridMesh->data.indices.size(), 1, 0, 0, 0);
+		cmd.draw(3, 1, 0, 0);
+
+		// Draw Track
+		if (gpuExtrusion && !onlyShowWireframe && trackExtrusion && trackExtrusion->vertexCount() > 0)
+		{
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *trackExtrusionPipeline.pipeline);
+			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *trackExtrusionPipeline.pipelineLayout, 0, { *frames[currentFrame].descriptorSet, *trackExtrusion->sampleBuffer.descriptorSet }, nullptr);
+			cmd.pushConstants<osp::TrackExtrusion::DrawConstants>(*trackExtrusionPipeline.pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, trackExtrusion->drawConstants());
+			cmd.draw(trackExtrusion->vertexCount(), 1, 0, 0);
+		}
+
+		// Draw Supports
+		if (showSupports && supports.instanceCount() > 0)
+		{
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *supportPipeline.pipeline);
+			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *supportPipeline.pipelineLayout, 0, { *frames[currentFrame].descriptorSet, *supports.instanceBuffer.descriptorSet }, nullptr);
+			cmd.pushConstants<osp::SupportStructures::DrawConstants>(*supportPipeline.pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, supports.drawConstants());
+			cmd.draw(osp::SupportStructures::VERTICES_PER_INSTANCE, supports.instanceCount(), 0, 0);
+		}
 
-		// Draw Track Mesh
 		auto& viewedMesh = onlyShowWireframe ? trackWireframeMesh : trackMesh;
+		osp::TrackMesh* buildingMesh = onlyShowWireframe ? nullptr : meshBuilder.mesh.get();
 
-		if (viewedMesh != nullptr && viewedMesh->mesh.data.indices.size() > 0)
+		if ((viewedMesh != nullptr && !viewedMesh->chunks.empty()) || buildingMesh != nullptr)
 		{
-			if (onlyShowWireframe) {
-				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *mainPipeline.pipeline);
-				cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *mainPipeline.pipelineLayout, 0, *frames[currentFrame].descriptorSet, nullptr);
+			osp::Pipeline& trackPipeline = onlyShowWireframe ? mainPipeline : steelMaterialPipeline;
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *trackPipeline.pipeline);
+			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *trackPipeline.pipelineLayout, 0, *frames[currentFrame].descriptorSet, nullptr);
+
+			auto drawChunk = [&](const osp::TrackMesh& mesh, const osp::TrackMesh::Chunk& chunk) {
+				const auto& range = chunk.lods[chunk.lod];
+				if (!chunk.visible || range.indexCount == 0) return;
+				cmd.pushConstants<osp::TrackMesh::DrawConstants>(*trackPipeline.pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, mesh.drawConstants(chunk));
+				cmd.bindVertexBuffers(0, { *chunk.mesh.vertexBuffer.buffer, *chunk.attributeBuffer.buffer }, { 0, 0 });
+				cmd.bindIndexBuffer(*chunk.mesh.indexBuffer.buffer, 0, osp::TrackMesh::INDEX_TYPE);
+				cmd.drawIndexed(range.indexCount, 1, range.firstIndex, range.vertexOffset, 0);
+			};
+
+			for (osp::TrackMesh* mesh : { viewedMesh.get(), buildingMesh }) {
+				if (!mesh) continue;
+				mesh->selectLods(camera.view, glm::radians(camera.fov), static_cast<float>(swapChain.extent.height));
+				mesh->cull(camera.view, camera.proj);
 			}
-			else {
-				cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *steelMaterialPipeline.pipeline);
-				cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *steelMaterialPipeline.pipelineLayout, 0, *frames[currentFrame].descriptorSet, nullptr);
+
+			if (buildingMesh && !buildingMesh->chunks.empty()) {
+				const auto& building = buildingMesh->chunks;
+				for (size_t i = 0; i < building.size(); i++) {
+					if (meshBuilder.built[i]) drawChunk(*buildingMesh, building[i]);
+				}
+
+				// arc lengths not rebuilt yet are covered by the chunks of the previous mesh overlapping them,
+				// both lists are sorted by s
+				if (viewedMesh) {
+					size_t first = 0;
+					for (const auto& chunk : viewedMesh->chunks) {
+						while (first < building.size() && building[first].sEnd <= chunk.sBegin) first++;
+						for (size_t i = first; i < building.size() && building[i].sBegin < chunk.sEnd; i++) {
+							if (!meshBuilder.built[i]) {
+								drawChunk(*viewedMesh, chunk);
+								break;
+							}
+						}
+					}
+				}
+			}
+			else if (viewedMesh) {
+				// the rebuild hasn't laid out its chunks yet
+				for (const auto& chunk : viewedMesh->chunks) {
+					drawChunk(*viewedMesh, chunk);
+				}
 			}
-			cmd.bindVertexBuffers(0, *viewedMesh->mesh.vertexBuffer.buffer, { 0 });
-			cmd.bindIndexBuffer(*viewedMesh->mesh.indexBuffer.buffer, 0, vk::IndexType::eUint32);
-			cmd.drawIndexed(viewedMesh->mesh.data.indices.size(), 1, 0, 0, 0);
 		}
 
 		cmd.endRendering();
@@ -972,6 +1473,8 @@ private:
 	{
 		auto& frame = frames[currentFrame];
 		while (vk::Result::eTimeout == context.device.waitForFences(*frame.inFlight, vk::True, UINT64_MAX));
+		freeRetired();
+		uploads.collect();
 		auto [result, imageIndex] = swapChain.swapChainKHR.acquireNextImage(UINT64_MAX, *frame.imageAvailable, nullptr);
 
 		if (result == vk::Result::eErrorOutOfDateKHR)
@@ -988,6 +1491,23 @@ private:
 		{
 			createTrack();
 		}
+		if (auto meshResult = meshWorker.poll())
+		{
+			adoptTrackMesh(*meshResult);
+		}
+		if (meshBuilder.active())
+		{
+			advanceTrackMesh();
+		}
+		if (coloringDirty)
+		{
+			recolorTrack();
+		}
+		if (supportsDirty)
+		{
+			regenerateSupports();
+		}
+		nodeEditor.trackMesh = onlyShowWireframe ? trackWireframeMesh.get() : trackMesh.get();
 
 		updateUniformBuffer(currentFrame);
 
@@ -998,6 +1518,7 @@ private:
 		vk::PipelineStageFlags waitDestinationStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput);
 		const vk::SubmitInfo   submitInfo{ .waitSemaphoreCount = 1, .pWaitSemaphores = &*frame.imageAvailable, .pWaitDstStageMask = &waitDestinationStageMask, .commandBufferCount = 1, .pCommandBuffers = &*frame.cmd, .signalSemaphoreCount = 1, .pSignalSemaphores = &*swapChain.renderFinished[imageIndex] };
 		context.queue.submit(submitInfo, *frame.inFlight);
+		submittedFrames++;
 
 		try
 		{
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "parallel_for.h"
+#include "track.h"
+#include "train_integrator.h"
+
+namespace osp
+{
+
+// Forces felt by the riders along the whole ride. The train is simulated from the start at rest, and
+// its v(s) is combined with the curve's derivatives and the rolled frames on a grid over s. The curve
+// is sampled once per grid point in parallel, everything after that runs on SoA arrays in plain loops
+// the compiler vectorizes. Results are the extremes per curve segment, the airtime regions and a time
+// series at a fixed interval for plotting and export.
+struct RideAnalysis
+{
+	struct Settings {
+		float  spacing = 0.5f;          // meters between samples
+		float  seriesInterval = 0.05f;  // seconds between points of the time series
+		float  airtimeThreshold = 0.0f; // vertical g below which riders lift off their seats
+		double duration = 600.0;        // simulated seconds before the run is given up
+		TrainIntegrator::Parameters physics;
+	};
+
+	// One entry per sample along s, accelerations in g along the rider's axes, jerk in g per second
+	struct Samples {
+		std::vector<float>    s, t, v;
+		std::vector<float>    curvatureX, curvatureY, curvatureZ;
+		std::vector<float>    rightX, rightY, rightZ;
+		std::vector<float>    upX, upY, upZ;
+		std::vector<float>    forwardX, forwardY, forwardZ;
+		std::vector<uint32_t> segment;
+		std::vector<float>    vertical, lateral, longitudinal, jerk;
+
+		size_t size() const { return s.size(); }
+	};
+
+	// Extremes over one curve segment
+	struct Element {
+		uint32_t segment;
+		float    sBegin, sEnd;
+		float    minVertical, maxVertical;
+		float    maxLateral; // absolute
+		float    minLongitudinal, maxLongitudinal;
+		float    maxJerk;
+		float    maxSpeed;
+		float    airtime; // seconds
+	};
+
+	struct AirtimeRegion {
+		float sBegin, sEnd;
+		float duration;
+		float minVertical;
+	};
+
+	struct Series {
+		std::vector<float> t, s, v, vertical, lateral, longitudinal, jerk;
+	};
+
+	Settings settings;
+
+	Samples                    samples;
+	std::vector<Element>       elements;
+	Element                    ride{}; // extremes over all elements
+	std::vector<AirtimeRegion> airtime;
+	Series                     series;
+	bool                       completed = false; // otherwise the train stalled or ran out of time at the last sample
+	float                      milliseconds = 0.0f;
+
+	// track needs its transport frames and slopes, see Track::update()
+	void analyze(Track& track)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		simulate(track);
+		sampleCurve(track);
+		computeForces();
+		computeJerk();
+		collectElements();
+		collectAirtime();
+		resampleSeries();
+
+		milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void writeSeriesCsv(std::ostream& out) const
+	{
+		out << "t,s,v,vertical,lateral,longitudinal,jerk\n";
+		for (size_t i = 0; i < series.t.size(); i++) {
+			out << series.t[i] << ',' << series.s[i] << ',' << series.v[i] << ',' << series.vertical[i] << ','
+				<< series.lateral[i] << ',' << series.longitudinal[i] << ',' << series.jerk[i] << '\n';
+		}
+	}
+
+	void writeElementsCsv(std::ostream& out) const
+	{
+		out << "segment,s_begin,s_end,min_vertical,max_vertical,max_lateral,min_longitudinal,max_longitudinal,max_jerk,max_speed,airtime\n";
+		for (const Element& e : elements) {
+			out << e.segment << ',' << e.sBegin << ',' << e.sEnd << ',' << e.minVertical << ',' << e.maxVertical << ',' << e.maxLateral << ','
+				<< e.minLongitudinal << ',' << e.maxLongitudinal << ',' << e.maxJerk << ',' << e.maxSpeed << ',' << e.airtime << '\n';
+		}
+	}
+
+private:
+	static constexpr float G = 9.81f;
+
+	// Runs the train until the end, a stop outside lifts and launches or the duration, and tabulates t(s) and
+	// v(s) on the grid. s only increases until then, so each grid point is interpolated between two steps.
+	void simulate(Track& track)
+	{
+		TrainIntegrator integrator;
+		integrator.parameters = settings.physics;
+		integrator.reset(0.0, 0.0f, 0.0f);
+
+		const SlopeTable& slopes = track.slopes;
+		const TrackZones& zones = track.zones;
+		TrackZones::Cursor cursor;
+		double  dt = 0.01;
+		double  time = 0.0;
+		float   lastS = 0.0f, lastV = 0.0f;
+		double  lastT = 0.0;
+
+		samples = {};
+		completed = false;
+		integrator.advanceTo(slopes, zones, 0.0);
+		lastV = integrator.v();
+		appendSample(0.0f, 0.0f, lastV);
+
+		while (time < settings.duration) {
+			time += dt;
+			integrator.advanceTo(slopes, zones, time);
+			float s = integrator.s();
+			float v = integrator.v();
+			if (s <= lastS || (v <= 0.0f && !zones.propels(s, cursor))) break;
+
+			for (float next = samples.s.size() * settings.spacing; next <= s; next = samples.s.size() * settings.spacing) {
+				float x = (next - lastS) / (s - lastS);
+				appendSample(next, static_cast<float>(glm::mix(lastT, time, static_cast<double>(x))), glm::mix(lastV, v, x));
+			}
+			lastS = s;
+			lastV = v;
+			lastT = time;
+
+			if (integrator.atEnd()) {
+				completed = true;
+				break;
+			}
+		}
+	}
+
+	void appendSample(float s, float t, float v)
+	{
+		samples.s.push_back(s);
+		samples.t.push_back(t);
+		samples.v.push_back(v);
+	}
+
+	// The only pass calling into the curve and the slope table, samples are independent and split across threads
+	void sampleCurve(Track& track)
+	{
+		size_t n = samples.size();
+		for (std::vector<float>* channel : { &samples.curvatureX, &samples.curvatureY, &samples.curvatureZ,
+			&samples.rightX, &samples.rightY, &samples.rightZ, &samples.upX, &samples.upY, &samples.upZ, &samples.forwardX, &samples.forwardY, &samples.forwardZ }) {
+			channel->resize(n);
+		}
+		samples.segment.resize(n);
+
+		parallelFor(n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				glm::mat4 frame = track.evaluateFrenet(samples.s[i]);
+				samples.rightX[i] = frame[0].x; samples.rightY[i] = frame[0].y; samples.rightZ[i] = frame[0].z;
+				samples.upX[i] = frame[1].x; samples.upY[i] = frame[1].y; samples.upZ[i] = frame[1].z;
+				samples.forwardX[i] = frame[2].x; samples.forwardY[i] = frame[2].y; samples.forwardZ[i] = frame[2].z;
+				glm::vec3 curvature = track.slopes.curvatureAt(samples.s[i]);
+				samples.curvatureX[i] = curvature.x; samples.curvatureY[i] = curvature.y; samples.curvatureZ[i] = curvature.z;
+				samples.segment[i] = static_cast<uint32_t>(track.curve->getSegmentAtLength(samples.s[i]));
+			}
+		}, 256);
+	}
+
+	// ds/dt = v, so the train accelerates by r''(s) v^2 + r'(s) dv/dt, with dv/dt = v dv/ds. r'' is the
+	// curvature from the slope table and r' the forward axis. The riders feel that plus the support against
+	// gravity. dv/ds is a central difference on the grid, one-sided neighbours are reused at both ends.
+	void computeForces()
+	{
+		size_t n = samples.size();
+		samples.vertical.assign(n, 0.0f);
+		samples.lateral.assign(n, 0.0f);
+		samples.longitudinal.assign(n, 0.0f);
+		if (n < 3) return;
+
+		const float  inv2h = 0.5f / settings.spacing;
+		const float* kx = samples.curvatureX.data();
+		const float* ky = samples.curvatureY.data();
+		const float* kz = samples.curvatureZ.data();
+		const float* v = samples.v.data();
+		const float* rx = samples.rightX.data(); const float* ry = samples.rightY.data(); const float* rz = samples.rightZ.data();
+		const float* ux = samples.upX.data(); const float* uy = samples.upY.data(); const float* uz = samples.upZ.data();
+		const float* fx = samples.forwardX.data(); const float* fy = samples.forwardY.data(); const float* fz = samples.forwardZ.data();
+		float* vertical = samples.vertical.data();
+		float* lateral = samples.lateral.data();
+		float* longitudinal = samples.longitudinal.data();
+
+		for (size_t i = 1; i + 1 < n; i++) {
+			float v2 = v[i] * v[i];
+			float dvdt = v[i] * (v[i + 1] - v[i - 1]) * inv2h;
+
+			float ax = kx[i] * v2 + fx[i] * dvdt;
+			float ay = ky[i] * v2 + fy[i] * dvdt + G;
+			float az = kz[i] * v2 + fz[i] * dvdt;
+
+			vertical[i] = (ax * ux[i] + ay * uy[i] + az * uz[i]) * (1.0f / G);
+			lateral[i] = (ax * rx[i] + ay * ry[i] + az * rz[i]) * (1.0f / G);
+			longitudinal[i] = (ax * fx[i] + ay * fy[i] + az * fz[i]) * (1.0f / G);
+		}
+		for (std::vector<float>* channel : { &samples.vertical, &samples.lateral, &samples.longitudinal }) {
+			(*channel)[0] = (*channel)[1];
+			(*channel)[n - 1] = (*channel)[n - 2];
+		}
+	}
+
+	// Rate of change of the felt acceleration over time, central differences like computeForces()
+	void computeJerk()
+	{
+		size_t n = samples.size();
+		samples.jerk.assign(n, 0.0f);
+		if (n < 3) return;
+
+		const float* t = samples.t.data();
+		const float* vertical = samples.vertical.data();
+		const float* lateral = samples.lateral.data();
+		const float* longitudinal = samples.longitudinal.data();
+		float*       jerk = samples.jerk.data();
+
+		for (size_t i = 1; i + 1 < n; i++) {
+			float invDt = 1.0f / std::max(t[i + 1] - t[i - 1], 1e-6f);
+			float jv = (vertical[i + 1] - vertical[i - 1]) * invDt;
+			float jl = (lateral[i + 1] - lateral[i - 1]) * invDt;
+			float jf = (longitudinal[i + 1] - longitudinal[i - 1]) * invDt;
+			jerk[i] = std::sqrt(jv * jv + jl * jl + jf * jf);
+		}
+		jerk[0] = jerk[1];
+		jerk[n - 1] = jerk[n - 2];
+	}
+
+	// Time spent between sample i and the next
+	float sampleDuration(size_t i) const
+	{
+		return i + 1 < samples.size() ? samples.t[i + 1] - samples.t[i] : 0.0f;
+	}
+
+	static Element emptyElement(uint32_t segment, float s)
+	{
+		float inf = std::numeric_limits<float>::infinity();
+		return { segment, s, s, inf, -inf, 0.0f, inf, -inf, 0.0f, 0.0f, 0.0f };
+	}
+
+	static void merge(Element& e, const Element& other)
+	{
+		e.sBegin = std::min(e.sBegin, other.sBegin);
+		e.sEnd = std::max(e.sEnd, other.sEnd);
+		e.minVertical = std::min(e.minVertical, other.minVertical);
+		e.maxVertical = std::max(e.maxVertical, other.maxVertical);
+		e.maxLateral = std::max(e.maxLateral, other.maxLateral);
+		e.minLongitudinal = std::min(e.minLongitudinal, other.minLongitudinal);
+		e.maxLongitudinal = std::max(e.maxLongitudinal, other.maxLongitudinal);
+		e.maxJerk = std::max(e.maxJerk, other.maxJerk);
+		e.maxSpeed = std::max(e.maxSpeed, other.maxSpeed);
+		e.airtime += other.airtime;
+	}
+
+	void collectElements()
+	{
+		elements.clear();
+		for (size_t i = 0; i < samples.size(); i++) {
+			if (elements.empty() || elements.back().segment != samples.segment[i]) {
+				elements.push_back(emptyElement(samples.segment[i], samples.s[i]));
+			}
+			Element sample = emptyElement(samples.segment[i], samples.s[i]);
+			sample.minVertical = sample.maxVertical = samples.vertical[i];
+			sample.maxLateral = std::abs(samples.lateral[i]);
+			sample.minLongitudinal = sample.maxLongitudinal = samples.longitudinal[i];
+			sample.maxJerk = samples.jerk[i];
+			sample.maxSpeed = samples.v[i];
+			sample.airtime = samples.vertical[i] < settings.airtimeThreshold ? sampleDuration(i) : 0.0f;
+			merge(elements.back(), sample);
+		}
+
+		ride = emptyElement(std::numeric_limits<uint32_t>::max(), 0.0f);
+		for (const Element& e : elements) {
+			merge(ride, e);
+		}
+	}
+
+	void collectAirtime()
+	{
+		airtime.clear();
+		bool inside = false;
+		for (size_t i = 0; i < samples.size(); i++) {
+			if (samples.vertical[i] >= settings.airtimeThreshold) {
+				inside = false;
+				continue;
+			}
+			if (!inside) {
+				airtime.push_back({ samples.s[i], samples.s[i], 0.0f, samples.vertical[i] });
+				inside = true;
+			}
+			AirtimeRegion& region = airtime.back();
+			region.sEnd = samples.s[i];
+			region.duration += sampleDuration(i);
+			region.minVertical = std::min(region.minVertical, samples.vertical[i]);
+		}
+	}
+
+	// Every seriesInterval seconds, interpolated between the samples around it
+	void resampleSeries()
+	{
+		series = {};
+		if (samples.size() < 2) return;
+
+		size_t count = static_cast<size_t>(samples.t.back() / settings.seriesInterval) + 1;
+		for (std::vector<float>* channel : { &series.t, &series.s, &series.v, &series.vertical, &series.lateral, &series.longitudinal, &series.jerk }) {
+			channel->reserve(count);
+		}
+
+		size_t j = 0;
+		for (size_t k = 0; k < count; k++) {
+			float t = k * settings.seriesInterval;
+			while (j + 2 < samples.size() && samples.t[j + 1] < t) j++;
+			float span = samples.t[j + 1] - samples.t[j];
+			float x = span > 0.0f ? std::clamp((t - samples.t[j]) / span, 0.0f, 1.0f) : 0.0f;
+			auto at = [&](const std::vector<float>& channel) { return glm::mix(channel[j], channel[j + 1], x); };
+
+			series.t.push_back(t);
+			series.s.push_back(at(samples.s));
+			series.v.push_back(at(samples.v));
+			series.vertical.push_back(at(samples.vertical));
+			series.lateral.push_back(at(samples.lateral));
+			series.longitudinal.push_back(at(samples.longitudinal));
+			series.jerk.push_back(at(samples.jerk));
+		}
+	}
+};
+
+} // namespace osp
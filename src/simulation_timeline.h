@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "slope_table.h"
+#include "track_zones.h"
+#include "train_integrator.h"
+
+namespace osp
+{
+
+// Checkpoints of one run of the train, about every interval seconds of run time. The integration from a
+// checkpoint only depends on its state, so seeking replays from the last checkpoint before the wanted
+// time and integrates at most one interval, however long the run. Seeking past the recorded part first
+// extends it. Zones don't change during a run, the only state besides s and v is whether the train has
+// reached the end.
+class SimulationTimeline
+{
+public:
+	struct Checkpoint {
+		double time = 0.0; // seconds since the start of the run
+		float  s = 0.0f;
+		float  v = 0.0f;
+		bool   atEnd = false;
+	};
+
+	double interval = 0.25;
+	double maxTime = 3600.0; // extending stops here, e.g. for a train swinging in a valley forever
+
+	// A new run from s with speed v
+	void start(float s, float v)
+	{
+		checkpoints.assign(1, { 0.0, s, v, false });
+	}
+
+	bool empty() const
+	{
+		return checkpoints.empty();
+	}
+
+	// Run time up to which seeking replays at most one interval
+	double recordedTime() const
+	{
+		return checkpoints.empty() ? 0.0 : checkpoints.back().time;
+	}
+
+	// Whether the recorded part reaches the end of the track
+	bool complete() const
+	{
+		return !checkpoints.empty() && checkpoints.back().atEnd;
+	}
+
+	// While running, keeps the state as a checkpoint once it is an interval past the recorded part
+	void record(double time, float s, float v, bool atEnd)
+	{
+		if (checkpoints.empty() || complete()) return;
+		if (time >= checkpoints.back().time + interval || (atEnd && time > checkpoints.back().time)) {
+			checkpoints.push_back({ time, s, v, atEnd });
+		}
+	}
+
+	// The state at time, integrated with integrator, which is reset
+	Checkpoint seek(TrainIntegrator& integrator, const SlopeTable& slopes, const TrackZones& zones, double time)
+	{
+		if (checkpoints.empty()) return {};
+		time = std::clamp(time, 0.0, maxTime);
+
+		if (time > recordedTime() + interval && !complete()) {
+			const Checkpoint& last = checkpoints.back();
+			integrator.reset(last.time, last.s, last.v);
+			for (double t = last.time + interval; t <= time && !complete(); t += interval) {
+				integrator.advanceTo(slopes, zones, t);
+				checkpoints.push_back({ t, integrator.s(), integrator.v(), integrator.atEnd() });
+			}
+		}
+
+		auto after = std::upper_bound(checkpoints.begin(), checkpoints.end(), time, [](double t, const Checkpoint& c) { return t < c.time; });
+		const Checkpoint& from = *std::prev(after);
+		if (from.atEnd) return from;
+
+		integrator.reset(from.time, from.s, from.v);
+		integrator.advanceTo(slopes, zones, time);
+		return { time, integrator.s(), integrator.v(), integrator.atEnd() };
+	}
+
+private:
+	std::vector<Checkpoint> checkpoints; // in time order
+};
+
+} // namespace osp
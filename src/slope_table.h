@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "constants.h"
+#include "curve.h"
+
+namespace osp
+{
+
+// Gravity along the tangent and curvature of the track, tabulated every spacing meters by Track::update().
+// The physics samples it with Catmull-Rom interpolation instead of evaluating the curve, and all trains
+// on the track share it.
+struct SlopeTable
+{
+	float spacing = 0.25f;
+	float totalLength = 0.0f;
+
+	std::vector<float>     slope;     // dot(GRAVITY, tangent), 1 straight down, -1 straight up, the last sample sits at totalLength
+	std::vector<glm::vec3> curvature; // change of the unit tangent per meter, towards the inside of the turn, 1/m
+
+	bool empty() const
+	{
+		return slope.empty();
+	}
+
+	void build(ICurve& curve)
+	{
+		begin(curve);
+		extend(curve, std::numeric_limits<size_t>::max());
+	}
+
+	// build() a part at a time for rebuilds spread over several frames: begin() and then extend() by at most
+	// count samples until it returns true. The table can't be sampled in between.
+	void begin(ICurve& curve)
+	{
+		totalLength = curve.totalLength();
+		slope.clear();
+		slope.reserve(sampleCount());
+		curvature.clear();
+		curvature.reserve(sampleCount());
+		tangents.clear();
+		tangents.reserve(sampleCount());
+	}
+
+	bool extend(ICurve& curve, size_t count)
+	{
+		size_t first = slope.size();
+		size_t n = std::min(count, sampleCount() - first);
+
+		std::vector<float> positions(n);
+		for (size_t i = 0; i < n; i++) {
+			positions[i] = positionOf(first + i);
+		}
+		tangents.resize(first + n);
+		curve.getTangentsAtLengths(positions.data(), tangents.data() + first, n);
+
+		for (size_t i = first; i < first + n; i++) {
+			tangents[i] = glm::normalize(tangents[i]);
+			slope.push_back(glm::dot(GRAVITY, tangents[i]));
+		}
+
+		// central differences, a sample's curvature waits for the sample after it unless it is the last
+		bool   complete = slope.size() == sampleCount();
+		size_t ready = complete ? slope.size() : std::max<size_t>(slope.size(), 1) - 1;
+		for (size_t i = curvature.size(); i < ready; i++) {
+			size_t a = i > 0 ? i - 1 : i;
+			size_t b = std::min(i + 1, slope.size() - 1);
+			float  distance = positionOf(b) - positionOf(a);
+			curvature.push_back(distance > 0.0f ? (tangents[b] - tangents[a]) / distance : glm::vec3(0.0f));
+		}
+		return complete;
+	}
+
+	float slopeAt(float s) const
+	{
+		return interpolate(slope, s);
+	}
+
+	glm::vec3 curvatureAt(float s) const
+	{
+		return interpolate(curvature, s);
+	}
+
+private:
+	std::vector<glm::vec3> tangents; // unit, kept for the curvature of the samples still to come
+
+	size_t sampleCount() const
+	{
+		return static_cast<size_t>(glm::max(totalLength, 0.0f) / spacing) + 2;
+	}
+
+	float positionOf(size_t i) const
+	{
+		return glm::min(i * spacing, totalLength);
+	}
+
+	template <typename T>
+	T interpolate(const std::vector<T>& values, float s) const
+	{
+		if (values.empty()) return T(0.0f);
+
+		size_t last = values.size() - 1;
+		float  x = std::clamp(s, 0.0f, totalLength) / spacing;
+		size_t i = std::min(static_cast<size_t>(x), last);
+		float  t = x - i;
+
+		T p0 = values[i > 0 ? i - 1 : 0];
+		T p1 = values[i];
+		T p2 = values[std::min(i + 1, last)];
+		T p3 = values[std::min(i + 2, last)];
+
+		if (i + 1 == last) {
+			// the last interval ends at totalLength and is usually shorter than spacing, so it gets a
+			// cubic Hermite over its own length with the tangents measured in it
+			float interval = totalLength / spacing - i;
+			if (interval <= 0.0f) return p1;
+			t = std::min(t / interval, 1.0f);
+			T m1 = interval * (p2 - p0) / (1.0f + interval);
+			T m2 = p2 - p1;
+			float t2 = t * t;
+			float t3 = t2 * t;
+			return (2.0f * t3 - 3.0f * t2 + 1.0f) * p1 + (t3 - 2.0f * t2 + t) * m1 + (3.0f * t2 - 2.0f * t3) * p2 + (t3 - t2) * m2;
+		}
+		return p1 + 0.5f * t * (p2 - p0 + t * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 + t * (3.0f * (p1 - p2) + p3 - p0)));
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "slope_table.h"
+#include "track_zones.h"
+#include "train_integrator.h"
+
+namespace osp
+{
+
+// Speed of the train over the whole track in one pass over evenly spaced samples, without time stepping.
+// While the train moves forward E = v^2 / 2 follows dE/ds = g(s) - mu * 9.81 - 2 * drag * E, g(s) being
+// gravity along the track under the cars. That is linear in E, so with g(s) averaged over the interval
+// between two samples it is solved exactly. Launches and brakes add their acceleration at the speed the
+// train enters an interval with, and lifts hold it at their speed. The time at each sample follows from
+// the mean of 1/v.
+struct SpeedProfile
+{
+	float spacing = 0.5f; // meters between samples
+
+	// Per sample, from s = 0 to the end of the track. Past a stall the speed is 0 and the time infinite.
+	std::vector<float> speed;
+	std::vector<float> time;
+
+	bool  completed = false; // reached the end, otherwise stalled at stallS and would roll back
+	float stallS = 0.0f;
+	float microseconds = 0.0f;
+
+	void solve(const SlopeTable& slopes, const TrackZones& zones, const TrainIntegrator::Parameters& parameters, float startSpeed = 0.0f)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		float  totalLength = slopes.totalLength;
+		size_t count = static_cast<size_t>(glm::max(totalLength, 0.0f) / spacing) + 2;
+		speed.assign(count, 0.0f);
+		time.assign(count, std::numeric_limits<float>::infinity());
+		completed = false;
+		stallS = 0.0f;
+
+		TrackZones::Cursor cursor;
+		auto sAt = [&](size_t i) { return glm::min(i * spacing, totalLength); };
+		auto energyOf = [](double v) { return 0.5 * v * v; };
+		// lifts hold the train at their speed
+		auto lift = [&](double s, double energy, bool& lifted) {
+			lifted = false;
+			for (uint32_t z : zones.at(static_cast<float>(s), cursor)) {
+				if (zones[z].type == TrackZone::Type::Lift) {
+					energy = std::max(energy, energyOf(zones[z].speed));
+					lifted = true;
+				}
+			}
+			return energy;
+		};
+
+		const double friction = parameters.rollingFriction * 9.81;
+		const double drag = parameters.dragCoeff;
+
+		// E after h meters at dE/ds = c - 2 * drag * E, and the distance where it reaches 0 if it does
+		auto advance = [&](double energy, double c, double h, double& stall) {
+			stall = -1.0;
+			if (drag > 0.0) {
+				double terminal = c / (2.0 * drag); // E the train settles to on a constant slope
+				double next = terminal + (energy - terminal) * std::exp(-2.0 * drag * h);
+				if (next <= 0.0 && terminal < 0.0) {
+					stall = -std::log(-terminal / (energy - terminal)) / (2.0 * drag);
+				}
+				return next;
+			}
+			double next = energy + c * h;
+			if (next <= 0.0) {
+				stall = energy / -c;
+			}
+			return next;
+		};
+
+		bool   lifted;
+		double energy = lift(0.0, energyOf(startSpeed), lifted);
+		double t = 0.0;
+		double g0 = parameters.train.gravityAlongTrack(slopes, 0.0f);
+		speed[0] = static_cast<float>(std::sqrt(2.0 * energy));
+		time[0] = 0.0f;
+
+		for (size_t i = 1; i < count; i++) {
+			double s0 = sAt(i - 1);
+			double h = sAt(i) - s0;
+			double g1 = parameters.train.gravityAlongTrack(slopes, sAt(i));
+			double c = 0.5 * (g0 + g1) - friction; // dE/ds without drag
+			g0 = g1;
+			double v0 = std::sqrt(2.0 * energy);
+
+			// launches and brakes act at the speed the train enters the interval with, up to their own speed
+			double push = 0.0;
+			double ceiling = std::numeric_limits<double>::infinity();
+			double floor = 0.0;
+			for (uint32_t z : zones.at(static_cast<float>(s0), cursor)) {
+				const TrackZone& zone = zones[z];
+				if (zone.type == TrackZone::Type::Launch && v0 < zone.speed) {
+					push += zone.force;
+					ceiling = std::min(ceiling, energyOf(zone.speed));
+				}
+				else if (zone.type == TrackZone::Type::MagneticBrake && v0 > zone.speed) {
+					push -= zone.force * (v0 - zone.speed);
+					floor = std::max(floor, energyOf(zone.speed));
+				}
+				else if (zone.type == TrackZone::Type::BlockBrake && (v0 > zone.speed || zone.speed <= 0.0f)) {
+					push -= zone.force;
+					floor = std::max(floor, energyOf(zone.speed));
+				}
+			}
+
+			double stall;
+			double next = advance(energy, c, h, stall);
+			if (push != 0.0) {
+				double zoneStall;
+				double pushed = advance(energy, c + push, h, zoneStall);
+				if (push > 0.0 && next < std::min(pushed, ceiling)) {
+					next = std::min(pushed, ceiling);
+					stall = -1.0;
+				}
+				else if (push < 0.0 && next > std::max(pushed, floor)) {
+					next = std::max(pushed, floor);
+					stall = next <= 0.0 ? zoneStall : -1.0;
+				}
+			}
+
+			next = lift(s0 + h, next, lifted);
+			if (lifted) stall = -1.0;
+
+			if (stall >= 0.0 || next <= 0.0) {
+				stall = std::clamp(stall, 0.0, h);
+				stallS = static_cast<float>(s0 + stall);
+				if (v0 > 0.0) t += 2.0 * stall / v0;
+				microseconds = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+				return;
+			}
+
+			energy = next;
+			double v1 = std::sqrt(2.0 * energy);
+			t += 2.0 * h / (v0 + v1);
+			speed[i] = static_cast<float>(v1);
+			time[i] = static_cast<float>(t);
+		}
+
+		completed = true;
+		stallS = totalLength;
+		microseconds = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	float speedAt(float s) const
+	{
+		return interpolate(speed, s);
+	}
+
+	// When the front of the train passes s, infinite when it stalls before
+	float timeAt(float s) const
+	{
+		if (!completed && s > stallS) return std::numeric_limits<float>::infinity();
+		return interpolate(time, s);
+	}
+
+private:
+	float interpolate(const std::vector<float>& values, float s) const
+	{
+		if (values.empty()) return 0.0f;
+
+		float  x = glm::max(s, 0.0f) / spacing;
+		size_t i = std::min(static_cast<size_t>(x), values.size() - 1);
+		size_t j = std::min(i + 1, values.size() - 1);
+		if (std::isinf(values[j])) return values[i];
+		return glm::mix(values[i], values[j], glm::min(x - i, 1.0f));
+	}
+};
+
+} // namespace osp
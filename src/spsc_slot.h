@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace osp
+{
+
+// Hands the latest value from one producer thread to one consumer thread. A value that was not taken yet
+// is replaced by the next publish(), so the consumer only ever sees the newest one. Both sides are a
+// single atomic exchange, neither ever blocks.
+template <typename T>
+class SpscSlot
+{
+public:
+	SpscSlot() = default;
+	SpscSlot(const SpscSlot&) = delete;
+	SpscSlot& operator=(const SpscSlot&) = delete;
+
+	~SpscSlot()
+	{
+		delete slot.load(std::memory_order_acquire);
+	}
+
+	// Producer side
+	void publish(std::unique_ptr<T> value)
+	{
+		delete slot.exchange(value.release(), std::memory_order_acq_rel);
+	}
+
+	// Consumer side, empty when nothing was published since the last take()
+	std::unique_ptr<T> take()
+	{
+		return std::unique_ptr<T>(slot.exchange(nullptr, std::memory_order_acq_rel));
+	}
+
+private:
+	std::atomic<T*> slot{ nullptr };
+};
+
+} // namespace osp
@@ -0,0 +1,64 @@
+#pragma once
+
+#if defined(__INTELLISENSE__) || !defined(USE_CPP20_MODULES)
+#	include <vulkan/vulkan_raii.hpp>
+#else
+import vulkan_hpp;
+#endif
+
+#include "gpu_buffer.h"
+#include "upload_queue.h"
+
+namespace osp
+{
+
+// Device local storage buffer with the descriptor set that binds it as set 1 of a pipeline
+// created with Pipeline::Config::vertexStorageBuffer
+struct StorageBuffer
+{
+	GpuBuffer               buffer;
+	vk::raii::DescriptorSet descriptorSet = nullptr;
+
+	// Replaces the buffer contents and waits for the copy. The descriptor set is rewritten, so no frame
+	// bound to it may still be in flight.
+	void upload(VkContext& context, vk::raii::CommandPool& commandPool, vk::raii::DescriptorPool& descriptorPool, vk::DescriptorSetLayout layout, size_t size, void* data)
+	{
+		buffer.upload(context, commandPool, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, data);
+		bind(context, descriptorPool, layout);
+	}
+
+	// Fills an empty StorageBuffer with contents queued on uploads, which nothing waits for. Frames in flight
+	// keep drawing from the buffer this one replaces, which has to live until they finish.
+	void upload(UploadQueue& uploads, VkContext& context, vk::raii::DescriptorPool& descriptorPool, vk::DescriptorSetLayout layout, size_t size, const void* data)
+	{
+		uploads.upload(buffer, size, vk::BufferUsageFlagBits::eStorageBuffer, data);
+		bind(context, descriptorPool, layout);
+	}
+
+private:
+	void bind(VkContext& context, vk::raii::DescriptorPool& descriptorPool, vk::DescriptorSetLayout layout)
+	{
+		if (descriptorSet == nullptr) {
+			vk::DescriptorSetAllocateInfo allocInfo{
+				.descriptorPool = descriptorPool,
+				.descriptorSetCount = 1,
+				.pSetLayouts = &layout };
+			descriptorSet = std::move(context.device.allocateDescriptorSets(allocInfo).front());
+		}
+
+		vk::DescriptorBufferInfo bufferInfo{
+			.buffer = buffer.buffer,
+			.offset = 0,
+			.range = vk::WholeSize };
+		vk::WriteDescriptorSet write{
+			.dstSet = descriptorSet,
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfo };
+		context.device.updateDescriptorSets(write, {});
+	}
+};
+
+} // namespace osp
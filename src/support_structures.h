@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "storage_buffer.h"
+#include "track.h"
+
+namespace osp
+{
+
+// Uniform grid over the ground plane holding track samples, used for the clearance checks of supports.
+// Points are added and removed one at a time, so only the samples of edited parts of the track change.
+struct TrackSpatialIndex
+{
+	struct Point {
+		glm::vec3 position;
+		float     s;
+	};
+
+	float cellSize = 2.0f;
+	std::vector<Point> points; // slots in freeSlots are unused
+	std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+
+	void clear(float newCellSize)
+	{
+		cellSize = newCellSize;
+		points.clear();
+		cells.clear();
+		freeSlots.clear();
+	}
+
+	uint32_t add(const Point& point)
+	{
+		uint32_t i;
+		if (!freeSlots.empty()) {
+			i = freeSlots.back();
+			freeSlots.pop_back();
+			points[i] = point;
+		}
+		else {
+			i = static_cast<uint32_t>(points.size());
+			points.push_back(point);
+		}
+		cells[keyOf(point.position)].push_back(i);
+		return i;
+	}
+
+	void remove(uint32_t i)
+	{
+		auto it = cells.find(keyOf(points[i].position));
+		if (it == cells.end()) return;
+		std::vector<uint32_t>& cellPoints = it->second;
+		auto found = std::find(cellPoints.begin(), cellPoints.end(), i);
+		if (found == cellPoints.end()) return;
+		*found = cellPoints.back();
+		cellPoints.pop_back();
+		freeSlots.push_back(i);
+	}
+
+	// Calls f for every point in a cell overlapping the xz box [lo, hi]
+	template <typename F>
+	void forEachNear(glm::vec2 lo, glm::vec2 hi, F&& f) const
+	{
+		for (int32_t x = cell(lo.x); x <= cell(hi.x); x++) {
+			for (int32_t z = cell(lo.y); z <= cell(hi.y); z++) {
+				auto it = cells.find(key(x, z));
+				if (it == cells.end()) continue;
+				for (uint32_t i : it->second) {
+					f(points[i]);
+				}
+			}
+		}
+	}
+
+private:
+	std::vector<uint32_t> freeSlots;
+
+	int32_t cell(float v) const
+	{
+		return static_cast<int32_t>(glm::floor(v / cellSize));
+	}
+
+	uint64_t keyOf(glm::vec3 position) const
+	{
+		return key(cell(position.x), cell(position.z));
+	}
+
+	static uint64_t key(int32_t x, int32_t z)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(z);
+	}
+};
+
+// Columns and bracing placed automatically along the track, drawn as instanced cylinders (support_shader.slang).
+// Supports are placed per curve segment, so editing a node only moves the supports of the segments it shapes.
+// Between runs only the supports of segments that changed or shifted, and those close to a change, are
+// evaluated again. Each keeps its place unless its segment changed or the track moved at its attach point.
+struct SupportStructures
+{
+	// Read from a storage buffer, keep in sync with SupportInstance in the shader
+	struct Instance {
+		glm::vec4 start; // xyz, w radius
+		glm::vec4 end;
+	};
+
+	// Keep in sync with DrawConstants in the shader
+	struct DrawConstants {
+		glm::vec4 color;
+	};
+
+	static constexpr uint32_t VERTICES_PER_INSTANCE = 8 * 6; // SEGMENTS quads in the shader
+
+	struct Settings {
+		float spacing = 8.0f;         // target distance between columns along the track
+		float minHeight = 1.5f;       // no column below this height above ground
+		float groundHeight = 0.0f;
+		float columnRadius = 0.2f;
+		float braceRadius = 0.06f;
+		float braceDrop = 1.2f;       // knee braces reach this far down the column and along the track
+		float braceMinHeight = 4.0f;  // columns shorter than this get no bracing
+		float maxBraceSpan = 12.0f;   // longest horizontal distance bridged by cross bracing
+		float clearance = 0.5f;       // free space kept between a support and any other part of the track
+	} settings;
+
+	struct Stats {
+		uint32_t columns = 0;
+		uint32_t braces = 0;
+		uint32_t blocked = 0;    // columns dropped because the track passes through them
+		uint32_t recomputed = 0; // supports placed from scratch in the last run, the others were reused
+		float    milliseconds = 0.0f;
+	} stats;
+
+	std::vector<Instance> instances;
+	StorageBuffer         instanceBuffer;
+	glm::vec3             color{ 0.55f, 0.55f, 0.58f };
+
+	// Places or updates the supports of the track, whose transport frames must be up to date
+	void generate(Track& track)
+	{
+		auto start = std::chrono::steady_clock::now();
+		stats = {};
+
+		ICurve& curve = *track.curve;
+		size_t segmentCount = curve.getNumSegments();
+
+		// A segment changed when a node shaping it did, its old and new bounds become dirty. It shifted when its
+		// arc lengths moved or the track moved at its middle, e.g. when an edit earlier on turns the transport
+		// frames or the curve is reparameterized as a whole.
+		std::vector<Bounds> dirty;
+		bool full = segmentCount != segments.size() || track.nodes.size() != nodes.size();
+		if (full) {
+			segments.clear();
+			index.clear(INDEX_CELL_SIZE);
+		}
+		segments.resize(segmentCount);
+
+		for (size_t i = 0; i < segmentCount; i++) {
+			Segment& segment = segments[i];
+			float sBegin = i == 0 ? 0.0f : curve.getSegmentEndLength(i - 1);
+			float sEnd = curve.getSegmentEndLength(i);
+			bool  moved = sBegin != segment.sBegin || sEnd != segment.sEnd;
+			segment.sBegin = sBegin;
+			segment.sEnd = sEnd;
+
+			segment.changed = !segment.valid;
+			size_t first = i > NODES_BEFORE ? i - NODES_BEFORE : 0;
+			size_t end = std::min(i + NODES_AFTER + 1, track.nodes.size());
+			for (size_t k = first; k < end && !segment.changed; k++) {
+				segment.changed = !sameNode(track.nodes[k], nodes[k]);
+			}
+
+			glm::vec3 probe = attachPoint(track, track.evaluateFrenet(0.5f * (sBegin + sEnd)));
+			segment.shifted = !segment.changed && (moved || glm::distance(probe, segment.probe) >= ATTACH_TOLERANCE);
+			segment.probe = probe;
+
+			if (segment.changed) {
+				Bounds bounds;
+				for (int k = 0; k < BOUNDS_SAMPLES; k++) {
+					bounds.add(curve.evaluate(glm::mix(sBegin, sEnd, (float)k / (BOUNDS_SAMPLES - 1))));
+				}
+				if (segment.valid) dirty.push_back(segment.bounds);
+				dirty.push_back(bounds);
+				segment.bounds = bounds;
+				segment.valid = true;
+			}
+			updateIndex(track, segment);
+		}
+		nodes = track.nodes;
+
+		float reach = reachOf(track) + settings.clearance;
+		for (Bounds& bounds : dirty) {
+			bounds.expand(reach + settings.maxBraceSpan);
+		}
+
+		// supports to place from scratch, their ground heights are looked up in one batch
+		std::vector<Support*>  pending;
+		std::vector<glm::vec2> footprints;
+		for (Segment& segment : segments) {
+			float length = segment.sEnd - segment.sBegin;
+			size_t count = std::max<size_t>(1, (size_t)glm::round(length / settings.spacing));
+			bool resize = segment.supports.size() != count;
+			segment.supports.resize(count);
+
+			for (size_t j = 0; j < count; j++) {
+				Support& support = segment.supports[j];
+				support.recomputed = false;
+
+				// supports of segments that neither changed nor shifted stay where they are
+				bool evaluate = segment.changed || segment.shifted || resize || !support.valid || intersects(dirty, support.bounds);
+				if (!evaluate) continue;
+
+				float     s = segment.sBegin + (j + 0.5f) * length / count;
+				glm::mat4 frenet = track.evaluateFrenet(s);
+				glm::vec3 attach = attachPoint(track, frenet);
+				bool      inverted = frenet[1][1] < 0.0f;
+
+				bool reuse = !segment.changed && !resize && support.valid && !intersects(dirty, support.bounds)
+					&& support.inverted == inverted && glm::distance(support.attach, attach) < ATTACH_TOLERANCE;
+				support.s = s;
+				if (reuse) continue;
+
+				support = {};
+				support.s = s;
+				support.attach = attach;
+				support.forward = glm::vec3(frenet[2]);
+				support.inverted = inverted;
+				support.recomputed = true;
+
+				pending.push_back(&support);
+				footprints.emplace_back(support.attach.x, support.attach.z);
+			}
+		}
+
+		std::vector<float> groundHeights;
+		queryGround(footprints, groundHeights);
+		for (size_t i = 0; i < pending.size(); i++) {
+			placeColumn(track, *pending[i], groundHeights[i]);
+		}
+		stats.recomputed = static_cast<uint32_t>(pending.size());
+
+		// cross bracing between consecutive columns, kept while neither end was replaced
+		Support* previous = nullptr;
+		for (Segment& segment : segments) {
+			for (Support& support : segment.supports) {
+				if (previous && (support.recomputed || previous->recomputed)) {
+					crossBrace(track, *previous, support);
+				}
+				previous = &support;
+			}
+		}
+		if (previous && previous->recomputed) {
+			previous->crossBraces.clear();
+		}
+
+		instances.clear();
+		for (const Segment& segment : segments) {
+			for (const Support& support : segment.supports) {
+				if (support.placed) stats.columns++;
+				else if (support.blocked) stats.blocked++;
+				stats.braces += static_cast<uint32_t>(support.instances.size() + support.crossBraces.size()) - (support.placed ? 1 : 0);
+
+				instances.insert(instances.end(), support.instances.begin(), support.instances.end());
+				instances.insert(instances.end(), support.crossBraces.begin(), support.crossBraces.end());
+			}
+		}
+
+		stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Forces the next generate() to place every support from scratch
+	void invalidate()
+	{
+		segments.clear();
+		nodes.clear();
+	}
+
+	uint32_t instanceCount() const
+	{
+		return static_cast<uint32_t>(instances.size());
+	}
+
+	DrawConstants drawConstants() const
+	{
+		return { glm::vec4(color, 1.0f) };
+	}
+
+	// Queues the instances in a new buffer and hands back the replaced one, frames in flight may still draw it
+	StorageBuffer upload(UploadQueue& uploads, VkContext& context, vk::raii::DescriptorPool& descriptorPool, vk::DescriptorSetLayout layout)
+	{
+		StorageBuffer replaced = std::move(instanceBuffer);
+		instanceBuffer = {};
+		if (!instances.empty()) {
+			instanceBuffer.upload(uploads, context, descriptorPool, layout, sizeof(instances[0]) * instances.size(), instances.data());
+		}
+		return replaced;
+	}
+
+private:
+	static constexpr int BOUNDS_SAMPLES = 5;
+	static constexpr float INDEX_SPACING = 0.5f;   // meters between track samples in the spatial index
+	static constexpr float INDEX_CELL_SIZE = 4.0f;
+	static constexpr float ATTACH_TOLERANCE = 0.01f; // a kept support's attach point may move this much
+
+	// Nodes shaping a segment: the four control points of a cubic NURBS span, and the tangent neighbours of a Hermite segment
+	static constexpr size_t NODES_BEFORE = 2;
+	static constexpr size_t NODES_AFTER = 4;
+
+	struct Bounds {
+		glm::vec3 lo{ std::numeric_limits<float>::max() };
+		glm::vec3 hi{ std::numeric_limits<float>::lowest() };
+
+		void add(glm::vec3 p)
+		{
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+
+		void expand(float r)
+		{
+			lo -= glm::vec3(r);
+			hi += glm::vec3(r);
+		}
+
+		bool intersects(const Bounds& other) const
+		{
+			return lo.x <= other.hi.x && hi.x >= other.lo.x
+				&& lo.y <= other.hi.y && hi.y >= other.lo.y
+				&& lo.z <= other.hi.z && hi.z >= other.lo.z;
+		}
+	};
+
+	struct Support {
+		float     s = 0.0f;
+		glm::vec3 attach{ 0.0f };
+		glm::vec3 forward{ 0.0f };
+		glm::vec3 foot{ 0.0f };
+		Bounds    bounds;
+		bool      inverted = false;
+		bool      placed = false;
+		bool      blocked = false;
+		bool      valid = false;
+		bool      recomputed = false; // placed from scratch in the current run
+
+		std::vector<Instance> instances;   // column and knee braces
+		std::vector<Instance> crossBraces; // towards the next support
+	};
+
+	struct Segment {
+		float sBegin = 0.0f;
+		float sEnd = 0.0f;
+		Bounds    bounds;
+		glm::vec3 probe{ 0.0f }; // attach point at the middle
+		bool      changed = true;
+		bool      shifted = false;
+		bool      valid = false;
+		std::vector<Support>  supports;
+		std::vector<uint32_t> indexPoints; // its samples in the spatial index
+	};
+
+	std::vector<Segment>     segments;
+	std::vector<Track::Node> nodes; // as of the last run
+	TrackSpatialIndex        index;
+
+	static bool sameNode(const Track::Node& a, const Track::Node& b)
+	{
+		return a.position == b.position && a.roll == b.roll && a.weight == b.weight && a.pinned == b.pinned;
+	}
+
+	// Bottom of the spine, where a column meets the track
+	static glm::vec3 attachPoint(const Track& track, const glm::mat4& frenet)
+	{
+		const auto& profile = track.profile;
+		return glm::vec3(frenet[3]) - glm::vec3(frenet[1]) * (profile.mainSplineOffset + profile.mainSplineRadius);
+	}
+
+	// Furthest the track geometry reaches from its center line
+	static float reachOf(const Track& track)
+	{
+		const auto& profile = track.profile;
+		return glm::length(glm::vec2(profile.railDistanceToCenter, profile.mainSplineOffset)) + profile.mainSplineRadius;
+	}
+
+	static bool intersects(const std::vector<Bounds>& dirty, const Bounds& bounds)
+	{
+		for (const Bounds& d : dirty) {
+			if (d.intersects(bounds)) return true;
+		}
+		return false;
+	}
+
+	// Ground height below every footprint. The ground is flat for now, all lookups go through here in one batch.
+	void queryGround(const std::vector<glm::vec2>& footprints, std::vector<float>& heights) const
+	{
+		heights.assign(footprints.size(), settings.groundHeight);
+	}
+
+	// The samples of a segment in the spatial index. Only changed segments are evaluated again, the samples of
+	// shifted ones stay in place and follow the segment's arc lengths.
+	void updateIndex(Track& track, Segment& segment)
+	{
+		if (segment.changed) {
+			for (uint32_t i : segment.indexPoints) {
+				index.remove(i);
+			}
+			segment.indexPoints.clear();
+
+			int count = std::max(2, (int)((segment.sEnd - segment.sBegin) / INDEX_SPACING) + 1);
+			for (int k = 0; k < count; k++) {
+				float s = glm::mix(segment.sBegin, segment.sEnd, (float)k / (count - 1));
+				segment.indexPoints.push_back(index.add({ track.evaluatePosition(s), s }));
+			}
+		}
+		else if (segment.shifted) {
+			size_t count = segment.indexPoints.size();
+			for (size_t k = 0; k < count; k++) {
+				index.points[segment.indexPoints[k]].s = glm::mix(segment.sBegin, segment.sEnd, (float)k / (count - 1));
+			}
+		}
+	}
+
+	// True when the track passes within the clearance of segment [a, b], ignoring the track around the given arc lengths
+	bool obstructed(const Track& track, glm::vec3 a, glm::vec3 b, float radius, float sA, float sB) const
+	{
+		float reach = reachOf(track);
+		float limit = reach + settings.clearance + radius;
+		float localWindow = 2.0f * reach + settings.braceDrop + settings.clearance;
+
+		glm::vec2 lo = glm::min(glm::vec2(a.x, a.z), glm::vec2(b.x, b.z)) - limit;
+		glm::vec2 hi = glm::max(glm::vec2(a.x, a.z), glm::vec2(b.x, b.z)) + limit;
+
+		glm::vec3 ab = b - a;
+		float     abLength2 = glm::dot(ab, ab);
+
+		bool hit = false;
+		index.forEachNear(lo, hi, [&](const TrackSpatialIndex::Point& point) {
+			if (hit) return;
+			if (glm::abs(point.s - sA) < localWindow || glm::abs(point.s - sB) < localWindow) return;
+
+			float t = abLength2 > 0.0f ? glm::clamp(glm::dot(point.position - a, ab) / abLength2, 0.0f, 1.0f) : 0.0f;
+			hit = glm::distance(point.position, a + t * ab) < limit;
+		});
+		return hit;
+	}
+
+	void placeColumn(const Track& track, Support& support, float groundHeight)
+	{
+		support.valid = true;
+		support.foot = glm::vec3(support.attach.x, groundHeight, support.attach.z);
+		support.bounds = Bounds();
+		support.bounds.add(support.attach);
+		support.bounds.add(support.foot);
+		support.bounds.expand(settings.braceDrop + settings.columnRadius);
+
+		// upside down sections would need a goose neck around the rails
+		float height = support.attach.y - groundHeight;
+		if (support.inverted || height < settings.minHeight) return;
+
+		if (obstructed(track, support.foot, support.attach, settings.columnRadius, support.s, support.s)) {
+			support.blocked = true;
+			return;
+		}
+		support.placed = true;
+		support.instances.push_back({ glm::vec4(support.foot, settings.columnRadius), glm::vec4(support.attach, 0.0f) });
+
+		if (height < settings.braceMinHeight) return;
+
+		glm::vec3 knee = support.attach - glm::vec3(0.0f, settings.braceDrop, 0.0f);
+		glm::vec3 along = glm::normalize(glm::vec3(support.forward.x, 0.0f, support.forward.z) + glm::vec3(1e-6f, 0.0f, 0.0f));
+		for (float side : { -1.0f, 1.0f }) {
+			glm::vec3 top = support.attach + side * settings.braceDrop * along;
+			support.instances.push_back({ glm::vec4(knee, settings.braceRadius), glm::vec4(top, 0.0f) });
+		}
+	}
+
+	// X bracing between two neighbouring columns that are both tall enough and close enough
+	void crossBrace(const Track& track, Support& a, const Support& b) const
+	{
+		a.crossBraces.clear();
+		if (!a.placed || !b.placed) return;
+		if (glm::distance(glm::vec2(a.foot.x, a.foot.z), glm::vec2(b.foot.x, b.foot.z)) > settings.maxBraceSpan) return;
+
+		float low = glm::max(a.foot.y, b.foot.y) + settings.minHeight;
+		float high = glm::min(a.attach.y, b.attach.y) - settings.braceDrop;
+		if (high - low < settings.braceMinHeight - settings.minHeight - settings.braceDrop) return;
+
+		glm::vec3 aLow(a.foot.x, low, a.foot.z), aHigh(a.foot.x, high, a.foot.z);
+		glm::vec3 bLow(b.foot.x, low, b.foot.z), bHigh(b.foot.x, high, b.foot.z);
+		for (auto [from, to] : { std::pair{ aLow, bHigh }, std::pair{ aHigh, bLow } }) {
+			if (obstructed(track, from, to, settings.braceRadius, a.s, b.s)) continue;
+			a.crossBraces.push_back({ glm::vec4(from, settings.braceRadius), glm::vec4(to, 0.0f) });
+		}
+	}
+};
+
+} // namespace osp
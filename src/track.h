@@ -1,17 +1,22 @@
 ﻿#pragma once
 #include <vector>
 #include <algorithm>
+#include <fstream>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <yaml-cpp/yaml.h>
 
-#include "mesh.h"
 #include "constants.h"
 #include "piecewise_linear_curve.h"
 #include "hermite_curve.h"
 #include "nurbs_curve.h"
+#include "slope_table.h"
+#include "track_zones.h"
 
 namespace osp
 {
@@ -28,7 +33,17 @@ struct Track
 
 		const float mainSplineRadius = 0.39f / 2.0f;
 		const float mainSplineOffset = 0.4f;
-	} const profile;
+
+		// Cross-section of the main spine, the box and I-beam fit into the tube's diameter
+		enum class SpineShape {
+			Tube,
+			Box,
+			IBeam
+		} spineShape = SpineShape::Tube;
+
+		const float spineFlangeThickness = 0.03f;
+		const float spineWebThickness = 0.02f;
+	} profile;
 
 	struct TransportFrame {
 		glm::vec3 right;
@@ -64,9 +79,21 @@ struct Track
 	std::vector<Node>       nodes;
 
 	std::vector<TransportFrame> transportFrames;
+	SlopeTable                  slopes;
+	TrackZones                  zones;
 
 	Track() = default;
 
+	// Deep copy with a cloned curve, see TrackMeshWorker
+	Track(const Track& other) :
+		profile(other.profile),
+		curve(other.curve ? other.curve->clone() : nullptr),
+		nodes(other.nodes),
+		transportFrames(other.transportFrames),
+		slopes(other.slopes),
+		zones(other.zones),
+		samplesPerMeter(other.samplesPerMeter) {}
+
 	void createEmpty()
 	{
 		std::unique_ptr<ICurve> tempCurve = std::make_unique<NURBSCurve>();
@@ -77,6 +104,7 @@ struct Track
 
 		nodes.emplace_back(glm::vec3(0.0f), 0.0f, 1.0f, true);
 		nodes.emplace_back(glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, 1.0f, true);
+		zones = TrackZones::defaultLift();
 
 		// Set up NURBS-specific properties
 		if (NURBSCurve* nurbsCurve = dynamic_cast<NURBSCurve*>(tempCurve.get())) {
@@ -107,6 +135,18 @@ struct Track
 		std::unique_ptr<ICurve> tempCurve;
 
 		nodes.clear();
+		if (config["spineShape"]) {
+			std::string spineShape = config["spineShape"].as<std::string>();
+			if (spineShape.compare("box") == 0) {
+				profile.spineShape = TrackProfile::SpineShape::Box;
+			}
+			else if (spineShape.compare("ibeam") == 0) {
+				profile.spineShape = TrackProfile::SpineShape::IBeam;
+			}
+			else {
+				profile.spineShape = TrackProfile::SpineShape::Tube;
+			}
+		}
 		if (!config["curveType"] || (curveType = config["curveType"].as<std::string>()).compare("linear") == 0) {
 			tempCurve = std::make_unique<PiecewiseLinearCurve>();
 		}
@@ -140,6 +180,11 @@ struct Track
 				tempCurve->appendControlPoint(glm::vec3(x, y, z));
 			}
 		}
+		if (config["knots"]) {
+			if (NURBSCurve* nurbsCurve = dynamic_cast<NURBSCurve*>(tempCurve.get())) {
+				nurbsCurve->knots = config["knots"].as<std::vector<float>>();
+			}
+		}
 
 
 		//if (config["points"]) {
@@ -156,6 +201,21 @@ struct Track
 		//	auto rolls = config["roll"].as<std::vector<float>>();
 		//}
 		
+		zones = TrackZones::defaultLift();
+		if (config["zones"]) {
+			zones.zones.clear();
+			for (const YAML::Node& zoneConfig : config["zones"]) {
+				TrackZone zone;
+				if (!zoneConfig["type"] || !TrackZone::parseType(zoneConfig["type"].as<std::string>(), zone.type)) continue;
+				zone.start = zoneConfig["start"] ? zoneConfig["start"].as<float>() : zone.start;
+				zone.end = zoneConfig["end"] ? zoneConfig["end"].as<float>() : zone.end;
+				zone.speed = zoneConfig["speed"] ? zoneConfig["speed"].as<float>() : zone.speed;
+				zone.force = zoneConfig["force"] ? zoneConfig["force"].as<float>() : zone.force;
+				zones.zones.push_back(zone);
+			}
+			zones.build();
+		}
+
 		curve = std::move(tempCurve);
 		curve->update();
 	}
@@ -180,6 +240,12 @@ struct Track
 		YAML::Emitter out;
 		out << YAML::BeginMap;
 		out << YAML::Key << "curveType" << YAML::Value << curveType;
+		if (profile.spineShape == TrackProfile::SpineShape::Box) {
+			out << YAML::Key << "spineShape" << YAML::Value << "box";
+		}
+		else if (profile.spineShape == TrackProfile::SpineShape::IBeam) {
+			out << YAML::Key << "spineShape" << YAML::Value << "ibeam";
+		}
 		out << YAML::Key << "points" << YAML::Value << YAML::BeginSeq;
 		for (size_t i = 0; i < N; i++) {
 			glm::vec3 p = nodes[i].position;
@@ -196,6 +262,24 @@ struct Track
 			out << nodes[i].weight;
 		}
 		out << YAML::EndSeq;
+		if (NURBSCurve* nurbsCurve = dynamic_cast<NURBSCurve*>(curve.get())) {
+			out << YAML::Key << "knots" << YAML::Value << YAML::BeginSeq;
+			for (float knot : nurbsCurve->knots) {
+				out << knot;
+			}
+			out << YAML::EndSeq;
+		}
+		out << YAML::Key << "zones" << YAML::Value << YAML::BeginSeq;
+		for (const TrackZone& zone : zones.zones) {
+			out << YAML::Flow << YAML::BeginMap;
+			out << YAML::Key << "type" << YAML::Value << TrackZone::TYPE_KEYS[static_cast<size_t>(zone.type)];
+			out << YAML::Key << "start" << YAML::Value << zone.start;
+			out << YAML::Key << "end" << YAML::Value << zone.end;
+			out << YAML::Key << "speed" << YAML::Value << zone.speed;
+			out << YAML::Key << "force" << YAML::Value << zone.force;
+			out << YAML::EndMap;
+		}
+		out << YAML::EndSeq;
 		out << YAML::EndMap;
 
 
@@ -223,6 +307,50 @@ struct Track
 		curve->update();
 	}
 
+	// Splits the segment ending at node i with a new node at position
+	void insertNode(size_t i, glm::vec3 position, float roll)
+	{
+		curve->insertControlPoint(i, position);
+		nodes.insert(nodes.begin() + i, Node(position, roll, 1.0f));
+		curve->update();
+	}
+
+	// Adds a node at arc length s and returns its index. On a NURBS curve this is a knot insertion, which keeps
+	// the shape of the track: the nodes around s move onto the refined control polygon and the one closest to s
+	// is returned. Elsewhere the node is put on the track and splits the segment under s.
+	size_t splitAt(float s)
+	{
+		size_t    seg;
+		glm::vec3 position = curve->evaluate(s, &seg);
+		float     roll = evaluateRoll(s, seg);
+
+		size_t             first;
+		std::vector<float> ratios;
+		NURBSCurve* nurbsCurve = dynamic_cast<NURBSCurve*>(curve.get());
+		if (!nurbsCurve || !nurbsCurve->insertKnot(s, first, ratios)) {
+			insertNode(seg + 1, position, roll);
+			return seg + 1;
+		}
+
+		// rolls are blended like the control points they belong to
+		size_t last = first + ratios.size() - 1;
+		std::vector<float> rolls(ratios.size());
+		for (size_t i = first; i <= last; i++) {
+			rolls[i - first] = glm::mix(nodes[i - 1].roll, nodes[i].roll, ratios[i - first]);
+		}
+		nodes.insert(nodes.begin() + last, Node(position, roll, 1.0f));
+
+		size_t closest = first;
+		for (size_t i = first; i <= last; i++) {
+			nodes[i].position = curve->getControlPoint(i);
+			nodes[i].weight = curve->getWeight(i);
+			nodes[i].roll = rolls[i - first];
+			if (glm::distance(nodes[i].position, position) < glm::distance(nodes[closest].position, position)) closest = i;
+		}
+		curve->update();
+		return closest;
+	}
+
 	void removeLastSegment()
 	{
 		curve->removeBack();
@@ -235,16 +363,21 @@ struct Track
 		return curve->evaluate(s);
 	}
 
+	// Roll in degrees at this arc length, interpolated between nodes
+	float evaluateRoll(float s, size_t seg)
+	{
+		float t = curve->normalizedInSegment(s);
+		seg = std::min(seg, nodes.size() - 2);
+		return glm::mix(nodes[seg].roll, nodes[seg + 1].roll, t);
+	}
+
 	glm::mat4 evaluateFrenet(float s)
 	{
 		size_t seg;
 		glm::vec3 pos = curve->evaluate(s, &seg);
 		auto      frame = sampleTransportFrame(s);
 
-		// find roll at this arc length by interpolating between nodes
-		float  t = curve->normalizedInSegment(s);
-		seg = std::min(seg, nodes.size() - 2);
-		float  rollVal = glm::mix(nodes[seg].roll, nodes[seg+1].roll, t);
+		float  rollVal = evaluateRoll(s, seg);
 
 		// apply roll on top of transport frame
 		glm::mat3 rollRot = glm::mat3(glm::rotate(glm::radians(rollVal), frame.forward));
@@ -268,6 +401,12 @@ struct Track
 	{
 		curve->update();
 		precomputeTransportFrames();
+		updateSlopes();
+	}
+
+	void updateSlopes()
+	{
+		slopes.build(*curve);
 	}
 
 	//
@@ -276,25 +415,33 @@ struct Track
 	float samplesPerMeter = 2.0f;
 
 	void precomputeTransportFrames() {
-		int numSamples = (int)(curve->totalLength() * samplesPerMeter + 0.5f);
-
 		transportFrames.clear();
-		transportFrames.reserve(numSamples);
+		propagateTransportFrames(transportFrames, std::numeric_limits<size_t>::max());
+	}
 
+	// precomputeTransportFrames() into frames with at most count more samples per call, for rebuilds spread
+	// over several frames. Starts from empty frames, returns true once they are complete.
+	bool propagateTransportFrames(std::vector<TransportFrame>& frames, size_t count) {
+		int numSamples = (int)(curve->totalLength() * samplesPerMeter + 0.5f);
 		float total = totalLength();
 
-		// first frame — bootstrap with world up
-		float     s0 = 0.0f;
-		glm::vec3 t0 = glm::normalize(curve->getTangentAtLength(s0));
-		glm::vec3 r0 = glm::normalize(glm::cross(t0, glm::vec3(0, 1, 0)));
-		glm::vec3 u0 = glm::cross(r0, t0);
-		transportFrames.push_back({ r0, u0, t0, s0 });
+		if (frames.empty()) {
+			frames.reserve(numSamples);
+
+			// first frame — bootstrap with world up
+			float     s0 = 0.0f;
+			glm::vec3 t0 = glm::normalize(curve->getTangentAtLength(s0));
+			glm::vec3 r0 = glm::normalize(glm::cross(t0, glm::vec3(0, 1, 0)));
+			glm::vec3 u0 = glm::cross(r0, t0);
+			frames.push_back({ r0, u0, t0, s0 });
+		}
 
-		for (int i = 1; i < numSamples; i++) {
+		int end = (int)frames.size() + (int)std::min<size_t>(numSamples - frames.size(), count);
+		for (int i = (int)frames.size(); i < end; i++) {
 			float     s1 = (float)i / (numSamples - 1) * total;
 			glm::vec3 t1 = glm::normalize(curve->getTangentAtLength(s1));
 
-			auto& prev = transportFrames.back();
+			auto& prev = frames.back();
 
 			// rotate previous frame to align with new tangent
 			glm::vec3 axis = glm::cross(prev.forward, t1);
@@ -316,8 +463,9 @@ struct Track
 				frame.right = glm::normalize(rot * prev.right);
 				frame.up = glm::normalize(rot * prev.up);
 			}
-			transportFrames.push_back(frame);
+			frames.push_back(frame);
 		}
+		return (int)frames.size() >= numSamples;
 	}
 
 	TransportFrame sampleTransportFrame(float s) {
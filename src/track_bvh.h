@@ -0,0 +1,298 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace osp
+{
+
+// Bounding volume hierarchy for picking the track with a ray. The primitives are the spans between two
+// consecutive track samples, each tested as capsules around the rails and the spine rather than as
+// triangles, so a hit yields its arc length directly. Spans are grouped like the TrackMesh chunks: every
+// chunk owns a tree over its spans, and a tree over the chunks is refit whenever one of them is replaced.
+// A tree taken over from the mesh being replaced is only refit where the track moved.
+struct TrackBvh
+{
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction; // normalized
+	};
+
+	struct Hit {
+		float     t = std::numeric_limits<float>::max();
+		float     s = 0.0f;
+		glm::vec3 position{ 0.0f };
+
+		bool valid() const { return t != std::numeric_limits<float>::max(); }
+	};
+
+	// Cross-section of one tube, offset along the right and up axes of the track frame
+	struct Tube {
+		glm::vec2 offset;
+		float     radius;
+	};
+
+	struct Aabb {
+		glm::vec3 lo{ std::numeric_limits<float>::max() };
+		glm::vec3 hi{ std::numeric_limits<float>::lowest() };
+
+		void add(glm::vec3 p)
+		{
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+
+		void add(const Aabb& other)
+		{
+			lo = glm::min(lo, other.lo);
+			hi = glm::max(hi, other.hi);
+		}
+
+		bool operator==(const Aabb&) const = default;
+
+		// Slab test, an empty box never intersects
+		bool intersects(const Ray& ray, glm::vec3 invDirection, float tMax) const
+		{
+			if (lo.x > hi.x) return false;
+
+			glm::vec3 t0 = (lo - ray.origin) * invDirection;
+			glm::vec3 t1 = (hi - ray.origin) * invDirection;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+			float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+			float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+			return enter <= exit;
+		}
+	};
+
+	std::array<Tube, 3> tubes{}; // left rail, right rail, spine
+
+	void setTubes(float railOffset, float railRadius, float spineOffset, float spineRadius)
+	{
+		tubes = { {
+			{ glm::vec2(-railOffset, 0.0f), railRadius },
+			{ glm::vec2(railOffset, 0.0f), railRadius },
+			{ glm::vec2(0.0f, -spineOffset), spineRadius } } };
+	}
+
+	// Keeps the spans of the first chunkCount chunks, setChunk() then only refits what differs from them
+	void resize(size_t chunkCount)
+	{
+		chunks.resize(chunkCount);
+		top.resize(chunkCount);
+		for (size_t c = 0; c < chunkCount; c++) {
+			top.setLeaf(c, chunks[c].tree.root());
+		}
+		top.refitAll();
+	}
+
+	void clear()
+	{
+		chunks.clear();
+		top.resize(0);
+	}
+
+	size_t chunkCount() const
+	{
+		return chunks.size();
+	}
+
+	// Replaces the spans of one chunk, samples hold the frames as mat3(right, up, forward).
+	// Only the leaves whose boxes changed are refit, along their paths to the root of the chunk tree.
+	void setChunk(size_t index, const glm::vec3* positions, const glm::mat3* frames, size_t sampleCount, float sBegin, float sEnd)
+	{
+		Chunk& chunk = chunks[index];
+		chunk.positions.assign(positions, positions + sampleCount);
+		chunk.frames.assign(frames, frames + sampleCount);
+		chunk.sBegin = sBegin;
+		chunk.ds = sampleCount > 1 ? (sEnd - sBegin) / (sampleCount - 1) : 0.0f;
+
+		size_t spans = sampleCount > 1 ? sampleCount - 1 : 0;
+		bool   rebuild = chunk.tree.leafCount != spans;
+		if (rebuild) chunk.tree.resize(spans);
+
+		float reach = 0.0f;
+		for (const Tube& tube : tubes) {
+			reach = glm::max(reach, glm::length(tube.offset) + tube.radius);
+		}
+		for (size_t k = 0; k < spans; k++) {
+			Aabb bounds;
+			bounds.add(positions[k]);
+			bounds.add(positions[k + 1]);
+			bounds.lo -= reach;
+			bounds.hi += reach;
+			if (!rebuild && chunk.tree.leaf(k) == bounds) continue;
+
+			chunk.tree.setLeaf(k, bounds);
+			if (!rebuild) chunk.tree.refitPath(k);
+		}
+		if (rebuild) chunk.tree.refitAll();
+
+		if (top.leaf(index) == chunk.tree.root()) return;
+		top.setLeaf(index, chunk.tree.root());
+		top.refitPath(index);
+	}
+
+	// Closest hit along the ray
+	Hit intersect(const Ray& ray) const
+	{
+		Hit       hit;
+		glm::vec3 invDirection = 1.0f / ray.direction;
+
+		top.traverse(ray, invDirection, hit.t, [&](uint32_t c) {
+			const Chunk& chunk = chunks[c];
+			chunk.tree.traverse(ray, invDirection, hit.t, [&](uint32_t k) {
+				intersectSpan(ray, chunk, k, hit);
+			});
+		});
+		return hit;
+	}
+
+private:
+	// Complete binary tree stored implicitly, node i has the children 2i + 1 and 2i + 2.
+	// The leaves follow the track, so neighbouring spans share a parent and the boxes stay tight.
+	struct Tree {
+		std::vector<Aabb> nodes;
+		uint32_t          leafCount = 0;
+		uint32_t          firstLeaf = 0;
+
+		void resize(size_t count)
+		{
+			leafCount = static_cast<uint32_t>(count);
+			uint32_t width = 1;
+			while (width < leafCount) width *= 2;
+			firstLeaf = width - 1;
+			nodes.assign(2 * width - 1, Aabb());
+		}
+
+		void setLeaf(size_t k, const Aabb& bounds)
+		{
+			nodes[firstLeaf + k] = bounds;
+		}
+
+		const Aabb& leaf(size_t k) const
+		{
+			return nodes[firstLeaf + k];
+		}
+
+		Aabb root() const
+		{
+			return nodes.empty() ? Aabb() : nodes[0];
+		}
+
+		void refitAll()
+		{
+			for (uint32_t i = firstLeaf; i-- > 0;) {
+				nodes[i] = nodes[2 * i + 1];
+				nodes[i].add(nodes[2 * i + 2]);
+			}
+		}
+
+		void refitPath(size_t k)
+		{
+			for (uint32_t i = firstLeaf + static_cast<uint32_t>(k); i > 0;) {
+				i = (i - 1) / 2;
+				nodes[i] = nodes[2 * i + 1];
+				nodes[i].add(nodes[2 * i + 2]);
+			}
+		}
+
+		// Calls f for every leaf whose box the ray enters before tMax, tMax may shrink while traversing
+		template <typename F>
+		void traverse(const Ray& ray, glm::vec3 invDirection, const float& tMax, F&& f) const
+		{
+			if (leafCount == 0) return;
+
+			uint32_t stack[64];
+			uint32_t size = 0;
+			stack[size++] = 0;
+			while (size > 0) {
+				uint32_t i = stack[--size];
+				if (!nodes[i].intersects(ray, invDirection, tMax)) continue;
+
+				if (i >= firstLeaf) {
+					f(i - firstLeaf);
+				}
+				else {
+					stack[size++] = 2 * i + 2;
+					stack[size++] = 2 * i + 1;
+				}
+			}
+		}
+	};
+
+	struct Chunk {
+		float sBegin = 0.0f;
+		float ds = 0.0f;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::mat3> frames;
+		Tree tree;
+	};
+
+	std::vector<Chunk> chunks;
+	Tree               top;
+
+	void intersectSpan(const Ray& ray, const Chunk& chunk, uint32_t k, Hit& hit) const
+	{
+		const glm::mat3& f0 = chunk.frames[k];
+		const glm::mat3& f1 = chunk.frames[k + 1];
+
+		for (const Tube& tube : tubes) {
+			glm::vec3 a = chunk.positions[k] + f0[0] * tube.offset.x + f0[1] * tube.offset.y;
+			glm::vec3 b = chunk.positions[k + 1] + f1[0] * tube.offset.x + f1[1] * tube.offset.y;
+
+			float h;
+			float t = intersectCapsule(ray, a, b, tube.radius, h);
+			if (t >= 0.0f && t < hit.t) {
+				hit.t = t;
+				hit.s = chunk.sBegin + (k + h) * chunk.ds;
+				hit.position = ray.origin + t * ray.direction;
+			}
+		}
+	}
+
+	// Ray against the capsule [a, b] with radius r, returns the distance or -1 and in h where along [a, b] it hit.
+	// After Inigo Quilez, https://iquilezles.org/articles/intersectors
+	static float intersectCapsule(const Ray& ray, glm::vec3 a, glm::vec3 b, float r, float& h)
+	{
+		glm::vec3 ba = b - a;
+		glm::vec3 oa = ray.origin - a;
+		float baba = glm::dot(ba, ba);
+		float bard = glm::dot(ba, ray.direction);
+		float baoa = glm::dot(ba, oa);
+		float rdoa = glm::dot(ray.direction, oa);
+		float oaoa = glm::dot(oa, oa);
+
+		float qa = baba - bard * bard;
+		float qb = baba * rdoa - baoa * bard;
+		float qc = baba * oaoa - baoa * baoa - r * r * baba;
+		float disc = qb * qb - qa * qc;
+		if (disc < 0.0f) return -1.0f;
+
+		// body, skipped when the ray runs along the axis
+		float y = baoa;
+		if (qa > 1e-8f) {
+			float t = (-qb - glm::sqrt(disc)) / qa;
+			y = baoa + t * bard;
+			if (y > 0.0f && y < baba) {
+				h = y / baba;
+				return t;
+			}
+		}
+
+		// caps
+		glm::vec3 oc = y <= 0.0f ? oa : ray.origin - b;
+		float cb = glm::dot(ray.direction, oc);
+		float cc = glm::dot(oc, oc) - r * r;
+		float capDisc = cb * cb - cc;
+		if (capDisc < 0.0f) return -1.0f;
+		h = y <= 0.0f ? 0.0f : 1.0f;
+		return -cb - glm::sqrt(capDisc);
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "parallel_for.h"
+#include "speed_profile.h"
+#include "track.h"
+#include "vertex.h"
+
+namespace osp
+{
+
+// Colours the track by a value along its arc length: height, the speed and vertical g-force of the
+// last simulation run, or the speed the SpeedProfile predicts for the current shape. Values are tabulated every spacing meters, TrackMesh::applyColoring() then looks
+// them up for its attribute stream without touching the geometry.
+struct TrackColoring
+{
+	enum class Mode {
+		None,
+		Height,
+		Speed,
+		GForce,
+		PredictedSpeed
+	};
+	static constexpr std::array<const char*, 5> MODE_NAMES = { "None", "Height", "Speed", "G-Force", "Predicted Speed" };
+
+	Mode  mode = Mode::None;
+	float spacing = 0.5f;
+
+	// Tabulated by evaluate(), NaN where the value is unknown, e.g. beyond where the train stopped
+	std::vector<float> values;
+	float minValue = 0.0f;
+	float maxValue = 0.0f;
+
+	// Speed per spacing interval as recorded by the simulation, NaN where the train has not been yet
+	std::vector<float> recordedSpeed;
+
+	// PredictedSpeed, solved on every evaluate()
+	TrainIntegrator::Parameters physics;
+	SpeedProfile                profile;
+
+	void resetRecording(float totalLength)
+	{
+		recordedSpeed.assign(sampleCount(totalLength), std::numeric_limits<float>::quiet_NaN());
+	}
+
+	// Keeps what was recorded so far when the track length changes
+	void fitRecording(float totalLength)
+	{
+		recordedSpeed.resize(sampleCount(totalLength), std::numeric_limits<float>::quiet_NaN());
+	}
+
+	// The train moved from s0 at speed v0 to s1 at speed v1, intervals in between get interpolated speeds.
+	// Only for moves without a jump in between, after one recording restarts with s0 == s1.
+	void record(float s0, float v0, float s1, float v1)
+	{
+		if (recordedSpeed.empty()) return;
+
+		auto index = [&](float s) { return std::min(static_cast<size_t>(glm::max(s, 0.0f) / spacing + 0.5f), recordedSpeed.size() - 1); };
+		size_t i0 = index(s0);
+		size_t i1 = index(s1);
+		size_t lo = std::min(i0, i1);
+		size_t hi = std::max(i0, i1);
+		for (size_t i = lo; i <= hi; i++) {
+			float t = hi > lo ? (float)(i - lo) / (hi - lo) : 1.0f;
+			recordedSpeed[i] = glm::abs(i0 <= i1 ? glm::mix(v0, v1, t) : glm::mix(v1, v0, t));
+		}
+	}
+
+	// Tabulates the values of the current mode, samples are independent and split across threads
+	void evaluate(Track& track)
+	{
+		float  totalLength = track.totalLength();
+		size_t count = sampleCount(totalLength);
+		values.assign(count, std::numeric_limits<float>::quiet_NaN());
+		if (mode == Mode::None || totalLength <= 0.0f) return;
+
+		if (mode == Mode::PredictedSpeed) {
+			profile.spacing = spacing;
+			profile.solve(track.slopes, track.zones, physics);
+		}
+
+		parallelFor(count, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				values[i] = sampleValue(track, i, totalLength);
+			}
+		}, 256);
+
+		minValue = std::numeric_limits<float>::max();
+		maxValue = std::numeric_limits<float>::lowest();
+		for (float value : values) {
+			if (std::isnan(value)) continue;
+			minValue = glm::min(minValue, value);
+			maxValue = glm::max(maxValue, value);
+		}
+		if (minValue > maxValue) {
+			minValue = maxValue = 0.0f;
+		}
+	}
+
+	// Attribute of a vertex at arc length s, fully transparent where there is no value
+	TrackVertexAttributes attributesAt(float s) const
+	{
+		TrackVertexAttributes attributes{};
+		if (values.empty()) return attributes;
+
+		float  x = glm::max(s, 0.0f) / spacing;
+		size_t i = std::min(static_cast<size_t>(x), values.size() - 1);
+		size_t j = std::min(i + 1, values.size() - 1);
+		float  a = values[i];
+		float  b = values[j];
+		if (std::isnan(a) && std::isnan(b)) return attributes;
+		if (std::isnan(a)) a = b;
+		if (std::isnan(b)) b = a;
+
+		float     range = maxValue - minValue;
+		float     t = range > 0.0f ? (glm::mix(a, b, glm::clamp(x - i, 0.0f, 1.0f)) - minValue) / range : 0.5f;
+		glm::vec3 color = ramp(t);
+		for (int c = 0; c < 3; c++) {
+			attributes.color[c] = static_cast<uint8_t>(glm::round(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f));
+		}
+		attributes.color[3] = 255;
+		return attributes;
+	}
+
+	// Blue over green and yellow to red
+	static glm::vec3 ramp(float t)
+	{
+		static const std::array<glm::vec3, 5> stops = { {
+			{ 0.15f, 0.25f, 0.90f },
+			{ 0.10f, 0.75f, 0.85f },
+			{ 0.20f, 0.80f, 0.25f },
+			{ 0.95f, 0.85f, 0.15f },
+			{ 0.90f, 0.15f, 0.10f } } };
+
+		float x = glm::clamp(t, 0.0f, 1.0f) * (stops.size() - 1);
+		size_t i = std::min(static_cast<size_t>(x), stops.size() - 2);
+		return glm::mix(stops[i], stops[i + 1], x - i);
+	}
+
+private:
+	size_t sampleCount(float totalLength) const
+	{
+		return static_cast<size_t>(glm::max(totalLength, 0.0f) / spacing) + 2;
+	}
+
+	float recordedSpeedAt(size_t i) const
+	{
+		return i < recordedSpeed.size() ? recordedSpeed[i] : std::numeric_limits<float>::quiet_NaN();
+	}
+
+	float sampleValue(Track& track, size_t i, float totalLength) const
+	{
+		float s = glm::min(i * spacing, totalLength);
+
+		switch (mode) {
+		case Mode::Height:
+			return track.evaluatePosition(s).y;
+		case Mode::Speed:
+			return recordedSpeedAt(i);
+		case Mode::PredictedSpeed:
+			return i < profile.speed.size() && !std::isinf(profile.time[i]) ? profile.speed[i] : std::numeric_limits<float>::quiet_NaN();
+		case Mode::GForce: {
+			// felt acceleration along the rider's up axis: centripetal v^2 * curvature plus the support against gravity
+			float v = recordedSpeedAt(i);
+			if (std::isnan(v)) return v;
+
+			glm::mat4 frame = track.evaluateFrenet(s);
+			glm::vec3 felt = v * v * track.slopes.curvatureAt(s) + glm::vec3(0.0f, 9.81f, 0.0f);
+			return glm::dot(felt, glm::vec3(frame[1])) / 9.81f;
+		}
+		default:
+			return std::numeric_limits<float>::quiet_NaN();
+		}
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,94 @@
+#pragma once
+
+#if defined(__INTELLISENSE__) || !defined(USE_CPP20_MODULES)
+#	include <vulkan/vulkan_raii.hpp>
+#else
+import vulkan_hpp;
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "storage_buffer.h"
+#include "track.h"
+
+namespace osp
+{
+
+// Track geometry built in the vertex shader (shaders/track_extrusion.slang).
+// Only one frame per sample is uploaded, the rails and the spine are expanded from the vertex index.
+struct TrackExtrusion
+{
+	// Read from a storage buffer, keep in sync with TrackSample in the shader
+	struct Sample {
+		glm::vec4 position;    // xyz position, w roll in radians
+		glm::vec4 orientation; // quaternion (xyzw) of the transport frame: x right, y up, -z forward
+	};
+
+	// Keep in sync with DrawConstants in the shader
+	struct DrawConstants {
+		glm::vec4 color;
+		glm::vec4 profile; // x rail offset, y rail radius, z spine offset, w spine radius
+		uint32_t  sampleCount;
+		uint32_t  segments;
+	};
+
+	static constexpr uint32_t TUBE_COUNT = 3; // left rail, right rail, spine
+
+	std::vector<Sample> samples;
+	StorageBuffer       sampleBuffer;
+
+	Track*    track = nullptr;
+	glm::vec3 color{ 0.1f, 0.2f, 1.0f };
+	float     sampleSpacing = 0.5f;
+	uint32_t  segments = 30;
+
+	// Samples the track like TrackMesh::sampleTrack, but keeps the roll separate from the transport frame
+	void generateSamples()
+	{
+		samples.clear();
+
+		float L = track->totalLength();
+		int   numSamples = std::max(2, (int)(L / sampleSpacing) + 1);
+		samples.reserve(numSamples);
+
+		for (int i = 0; i < numSamples; i++) {
+			float  s = (float)i / (numSamples - 1) * L;
+			size_t seg;
+
+			glm::vec3 pos = track->curve->evaluate(s, &seg);
+			auto      frame = track->sampleTransportFrame(s);
+			float     roll = glm::radians(track->evaluateRoll(s, seg));
+
+			glm::quat orientation = glm::quat_cast(glm::mat3(frame.right, frame.up, -frame.forward));
+			samples.push_back({
+				glm::vec4(pos, roll),
+				glm::vec4(orientation.x, orientation.y, orientation.z, orientation.w) });
+		}
+	}
+
+	uint32_t vertexCount() const
+	{
+		if (samples.size() < 2) return 0;
+		return TUBE_COUNT * static_cast<uint32_t>(samples.size() - 1) * segments * 6;
+	}
+
+	DrawConstants drawConstants() const
+	{
+		const auto& profile = track->profile;
+		return {
+			glm::vec4(color, 1.0f),
+			glm::vec4(profile.railDistanceToCenter, profile.runningRailRadius, profile.mainSplineOffset, profile.mainSplineRadius),
+			static_cast<uint32_t>(samples.size()),
+			segments };
+	}
+
+	// Any frame using the previous buffer must have finished
+	void upload(VkContext& context, vk::raii::CommandPool& commandPool, vk::raii::DescriptorPool& descriptorPool, vk::DescriptorSetLayout layout)
+	{
+		if (samples.empty()) return;
+		sampleBuffer.upload(context, commandPool, descriptorPool, layout, sizeof(samples[0]) * samples.size(), samples.data());
+	}
+};
+
+} // namespace osp
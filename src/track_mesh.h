@@ -6,83 +6,222 @@
 import vulkan_hpp;
 #endif
 
+#include <array>
+#include <limits>
+#include <stop_token>
+
 #include <glm/gtx/rotate_vector.hpp>
 
+#include "mesh.h"
 #include "track.h"
+#include "track_bvh.h"
+#include "linear_arena.h"
+#include "mesh_optimizer.h"
+#include "parallel_for.h"
+#include "profile_extrusion.h"
+#include "track_coloring.h"
 
 namespace osp
 {
 
 struct TrackMesh
 {
-	Mesh mesh;
-	Track* track;
+	// Detail of one level in the LOD chain, level 0 being the full detail mesh
+	struct LodLevel {
+		int segments;     // vertices per tube ring
+		int ringStride;   // only every n-th sample ring is extruded
+		int tieSegments;  // 0 = no cross ties
+	};
+	static constexpr int LOD_COUNT = 4;
+
+	struct DrawRange {
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		int32_t  vertexOffset = 0;
+
+		// Normal cone of the range's triangles, a cutoff of 1 or more means it is never backface culled
+		glm::vec3 coneAxis{ 0.0f, 0.0f, 1.0f };
+		float     coneCutoff = 1.0f;
+	};
+
+	// Indices are relative to the range's vertexOffset, so every range of a chunk fits 16 bit indices
+	using Index = uint16_t;
+	static constexpr vk::IndexType INDEX_TYPE = vk::IndexType::eUint16;
+	static constexpr uint32_t      MAX_RANGE_VERTICES = 65536;
+
+	// Push constants of a chunk draw, see main_shader.slang / steel_material_shader.slang
+	struct DrawConstants {
+		glm::vec4 chunkOrigin; // xyz origin, w extent
+		glm::vec4 color;
+	};
+
+	// Vertices [firstVertex, firstVertex + count) of a chunk, all sitting at arc length s
+	struct AttributeRun {
+		uint32_t firstVertex;
+		uint32_t count;
+		float    s;
+	};
+
+	// A piece of the track covering [sBegin, sEnd]. Every chunk holds all of its LOD levels
+	// in one vertex/index buffer pair, the level drawn is picked per frame by selectLods().
+	struct Chunk {
+		TrackChunkMesh mesh;
+		float sBegin = 0.0f;
+		float sEnd = 0.0f;
+
+		// Second vertex stream, rewritten by applyColoring() from the runs without regenerating the geometry
+		std::vector<TrackVertexAttributes> attributes;
+		std::vector<AttributeRun>          attributeRuns;
+		GpuBuffer                          attributeBuffer;
+
+		// Vertex positions are quantized relative to origin.xyz and scaled by origin.w
+		glm::vec4 origin{ 0.0f, 0.0f, 0.0f, 1.0f };
+
+		glm::vec3 center{ 0.0f };
+		float     radius = 0.0f;
+
+		std::array<DrawRange, LOD_COUNT> lods{};
+		int lod = 0;
+		bool visible = true; // result of the last cull()
+
+		// Triangle weighted cache miss ratio over all levels, before and after optimizeChunkIndices()
+		float    acmrBefore = 0.0f;
+		float    acmrAfter = 0.0f;
+		uint32_t triangles = 0;
+	};
+
+	std::vector<Chunk> chunks;
+	Track* track = nullptr;
+
+	// Picking structure over the same chunks, refit as each chunk is generated. Taken over from the mesh this
+	// one replaces, it is only refit where the track moved.
+	TrackBvh bvh;
+
+	//glm::vec3 color{ 0.95f, 0.05f, 0.1f };
+	glm::vec3 color{ 0.1f, 0.2f, 1.0f };
 
 	const float sampleSpacing = 0.5f;
 	const float tieEvery = 1.25f;
 
 	const int segments = 30;
+	const int samplesPerChunk = 64;
+
+	const std::array<LodLevel, LOD_COUNT> lodLevels = { {
+		{ segments, 1, 10 },
+		{ 12, 2, 6 },
+		{ 6, 4, 0 },
+		{ 4, 8, 0 } } };
+
+	// Projected chunk diameter in pixels below which the next coarser level is used
+	const std::array<float, LOD_COUNT - 1> lodSwitchPixels = { 600.0f, 200.0f, 60.0f };
+	// Relative band around each switch size in which a chunk keeps its current level
+	const float lodHysteresis = 0.2f;
+
+	// Post-generation index reordering, see mesh_optimizer.h
+	bool optimizeVertexCache = true;
+	bool reduceOverdraw = true;
+
+	// Chunks that passed the last cull()
+	uint32_t visibleChunks = 0;
+
+	// Triangle weighted average cache miss ratio of all chunk ranges, before and after reordering
+	struct IndexStats {
+		float acmrBefore = 0.0f;
+		float acmrAfter = 0.0f;
+	} indexStats;
 
 	TrackMesh() = default;
 
-	void generateTube(
-		const std::vector<glm::vec3>& positions,
-		const std::vector<glm::mat3>& frames,
-		glm::vec2 offset, float radius, int segments, glm::vec3 color) 
+	// Cross-sections of one LOD level, tabulated once per rebuild and swept along the frames
+	struct LodSections {
+		ProfileSection rail;
+		ProfileSection spine;
+		ProfileSection tie;
+	};
+	std::array<LodSections, LOD_COUNT> sections;
+
+	void buildSections()
 	{
-		auto& vertices = mesh.data.vertices;
-		auto& indices = mesh.data.indices;
+		const auto& profile = track->profile;
+		float spineSize = 2.0f * profile.mainSplineRadius;
+
+		for (int l = 0; l < LOD_COUNT; l++) {
+			const LodLevel& level = lodLevels[l];
+			LodSections& lodSections = sections[l];
+
+			lodSections.rail = ProfileSection::circle(profile.runningRailRadius, level.segments);
+			switch (profile.spineShape) {
+			case Track::TrackProfile::SpineShape::Box:
+				lodSections.spine = ProfileSection::box(spineSize, spineSize);
+				break;
+			case Track::TrackProfile::SpineShape::IBeam:
+				lodSections.spine = ProfileSection::iBeam(spineSize, spineSize, profile.spineFlangeThickness, profile.spineWebThickness);
+				break;
+			default:
+				lodSections.spine = ProfileSection::circle(profile.mainSplineRadius, level.segments);
+				break;
+			}
+			lodSections.tie = level.tieSegments > 0 ? ProfileSection::circle(profile.tieRadius, level.tieSegments) : ProfileSection{};
+		}
+	}
 
-		uint32_t baseVertex = vertices.size();
+	// Most sample intervals per chunk, up to samplesPerChunk, for which every level stays within MAX_RANGE_VERTICES
+	int chunkSampleCount(float ds) const
+	{
+		for (int n = samplesPerChunk; n > 1; n--) {
+			uint32_t maxVertices = 0;
+			for (int l = 0; l < LOD_COUNT; l++) {
+				const LodSections& lodSections = sections[l];
+				uint32_t rings = n / lodLevels[l].ringStride + 2;
+				uint32_t ties = lodLevels[l].tieSegments > 0 ? (uint32_t)(n * ds / tieEvery) + 2 : 0;
+				uint32_t vertices = rings * (2 * lodSections.rail.count + lodSections.spine.count) + ties * 3 * 2 * lodSections.tie.count;
+				maxVertices = std::max(maxVertices, vertices);
+			}
+			if (maxVertices <= MAX_RANGE_VERTICES) return n;
+		}
+		return 1;
+	}
 
-		for (int i = 0; i < positions.size(); i++) {
-			glm::vec3 right = frames[i][0];
-			glm::vec3 up = frames[i][1];
-			glm::vec3 center = positions[i] + offset.x * right + offset.y * up;
-
-			for (int s = 0; s < segments; s++) {
-				float angle = (float)s / segments * glm::two_pi<float>();
-				glm::vec3 normal = glm::cos(angle) * right + glm::sin(angle) * up;
-				glm::vec3 pos = center + normal * radius;
-
-				vertices.push_back({
-					pos,
-					color,
-					glm::vec2((float)s / segments, (float)i / positions.size()),
-					normal
-				});
-
-				// Indices
-				if (i == positions.size() - 1) continue;
-
-				uint32_t a = baseVertex + i * segments + s;
-				uint32_t b = baseVertex + i * segments + (s + 1) % segments;
-				uint32_t c = baseVertex + (i + 1) * segments + s;
-				uint32_t d = baseVertex + (i + 1) * segments + (s + 1) % segments;
-
-				indices.push_back(a);
-				indices.push_back(c);
-				indices.push_back(b);
-
-				indices.push_back(b);
-				indices.push_back(c);
-				indices.push_back(d);
+	// Marks count vertices from firstVertex on as sitting at s, extending the previous run when it ends there with the same s
+	static void addAttributeRun(Chunk& chunk, size_t firstVertex, size_t count, float s)
+	{
+		if (!chunk.attributeRuns.empty()) {
+			AttributeRun& run = chunk.attributeRuns.back();
+			if (run.s == s && run.firstVertex + run.count == firstVertex) {
+				run.count += static_cast<uint32_t>(count);
+				return;
 			}
 		}
+		chunk.attributeRuns.push_back({ static_cast<uint32_t>(firstVertex), static_cast<uint32_t>(count), s });
+	}
+
+	void extrudeSection(
+		Chunk& chunk, const DrawRange& range,
+		const glm::vec3* positions, const glm::mat3* frames, const float* ringS, size_t ringCount,
+		glm::vec2 offset, const ProfileSection& section)
+	{
+		auto& vertices = chunk.mesh.data.vertices;
+
+		uint32_t baseVertex = vertices.size() - range.vertexOffset;
+		size_t   firstVertex = vertices.size();
+
+		for (size_t i = 0; i < ringCount; i++) {
+			addAttributeRun(chunk, firstVertex + i * section.count, section.count, ringS[i]);
+		}
+		vertices.resize(firstVertex + ringCount * section.count);
+		extrudeRings(section, positions, frames, ringCount, offset, chunk.origin, vertices.data() + firstVertex);
+		extrudeIndices(section, ringCount, baseVertex, chunk.mesh.data.indices);
 	}
 
 	void generateCrossTie(
+		Chunk& chunk, const DrawRange& range,
 		glm::vec3 center, glm::vec3 right, glm::vec3 up,
-		glm::vec3 forward, float railOffset, glm::vec3 color,
-		int segments = 10, float tieRadius = 0.008f, bool formTriangle = true)
+		glm::vec3 forward, float s, float railOffset, const ProfileSection& section)
 	{
 		glm::vec3 leftPos = center - right * railOffset;
 		glm::vec3 rightPos = center + right * railOffset;
 		glm::vec3 centerPos = center - up * track->profile.mainSplineOffset;
 
-		// build two positions and frames for a single tube segment
-		std::vector<glm::vec3> tiePositions = { leftPos, rightPos };
-
 		// for the tie, "forward" is along right axis
 		// so we need a frame where right/up are perpendicular to the tie direction
 		glm::vec3 tieForward = glm::normalize(rightPos - leftPos);
@@ -90,36 +229,49 @@ struct TrackMesh
 		glm::vec3 tieUp = glm::normalize(glm::cross(tieForward, tieRight));
 		tieRight = glm::normalize(glm::cross(tieUp, tieForward));
 
-		std::vector<glm::mat3> tieFrames = {
+		glm::mat3 tieFrames[2] = {
 			glm::mat3(tieRight, tieUp, tieForward),
 			glm::mat3(tieRight, tieUp, tieForward)
 		};
 
-		generateTube(tiePositions, tieFrames, glm::vec2(0.0f), tieRadius, segments, color);
-		generateTube({leftPos, centerPos}, tieFrames, glm::vec2(0.0f), tieRadius, segments, color);
-		generateTube({rightPos, centerPos}, tieFrames, glm::vec2(0.0f), tieRadius, segments, color);
+		// three tube segments of two rings each
+		glm::vec3 tiePositions[3][2] = {
+			{ leftPos, rightPos },
+			{ leftPos, centerPos },
+			{ rightPos, centerPos } };
+
+		float tieS[2] = { s, s };
+		for (const auto& beam : tiePositions) {
+			extrudeSection(chunk, range, beam, tieFrames, tieS, 2, glm::vec2(0.0f), section);
+		}
 	}
 
-	void generateMesh()
+	// Evenly samples the track every ~sampleSpacing meters, first and last sample sitting exactly on the ends
+	int sampleTrack(std::pmr::vector<glm::vec3>& positions, std::pmr::vector<glm::mat3>& frames)
 	{
-		if (!track) return;
-
-		mesh.data.vertices.clear();
-		mesh.data.indices.clear();
-
-		//glm::vec3 color{ 0.95f, 0.05f, 0.1f };
-		glm::vec3 color{ 0.1f, 0.2f, 1.0f };
+		int numSamples = sampleCount();
+
+		positions.clear();
+		frames.clear();
+		positions.reserve(numSamples);
+		frames.reserve(numSamples);
+		appendSamples(positions, frames, numSamples, numSamples);
+		return numSamples;
+	}
 
-		std::vector<glm::vec3> positions;
-		std::vector<glm::mat3> frames;
+	int sampleCount() const
+	{
+		return std::max(2, static_cast<int>(track->totalLength() / sampleSpacing) + 1);
+	}
 
+	// Appends up to count more of the numSamples samples of sampleTrack(), returns true once all are there
+	bool appendSamples(std::pmr::vector<glm::vec3>& positions, std::pmr::vector<glm::mat3>& frames, int numSamples, int count)
+	{
 		float totalLength = track->totalLength();
-		int numSamples = static_cast<int>(totalLength / sampleSpacing);
+		int   end = static_cast<int>(std::min<int64_t>(numSamples, (int64_t)positions.size() + count));
 
-		for (int i = 0; i <= numSamples; i++) {
-			float t = (float)i / (float)(numSamples - 1);
-			t = glm::clamp(t, 0.0f, 1.0f);
-			float s = t * totalLength;
+		for (int i = static_cast<int>(positions.size()); i < end; i++) {
+			float s = (float)i / (float)(numSamples - 1) * totalLength;
 
 			glm::mat4 fren = track->evaluateFrenet(s);
 			glm::vec3 pos = fren[3];
@@ -131,168 +283,549 @@ struct TrackMesh
 			positions.push_back(pos);
 			frames.push_back(glm::mat3(right, up, forward));
 		}
+		return static_cast<int>(positions.size()) == numSamples;
+	}
 
-		generateTube(positions, frames, glm::vec2(-track->profile.railDistanceToCenter, 0.0f), track->profile.runningRailRadius, segments, color);
-		generateTube(positions, frames, glm::vec2(track->profile.railDistanceToCenter, 0.0f), track->profile.runningRailRadius, segments, color);
+	// Frames of the cross ties in [sBegin, sEnd), the last chunk also takes a tie sitting exactly on its end
+	void collectTies(const Chunk& chunk, bool isLastChunk, std::pmr::vector<glm::mat4>& ties, std::pmr::vector<float>& tieS)
+	{
+		ties.clear();
+		tieS.clear();
+		for (int t = (int)std::ceil(chunk.sBegin / tieEvery); ; t++) {
+			float s = t * tieEvery;
+			if (s > chunk.sEnd || (s == chunk.sEnd && !isLastChunk)) break;
+			ties.push_back(track->evaluateFrenet(s));
+			tieS.push_back(s);
+		}
+	}
 
-		generateTube(positions, frames, glm::vec2(0.0f, -track->profile.mainSplineOffset), track->profile.mainSplineRadius, segments, color);
+	// Furthest any profile geometry reaches from the track center line
+	float profileReach() const
+	{
+		const auto& profile = track->profile;
+		float radius = glm::max(glm::max(profile.runningRailRadius, profile.mainSplineRadius), profile.tieRadius);
+		return glm::length(glm::vec2(profile.railDistanceToCenter, profile.mainSplineOffset)) + radius;
+	}
 
-		// cross ties
-		int i = 0;
-		float s = 0.0f;
-		while ((s = i * tieEvery) <= totalLength) {
-			glm::mat4 fren = track->evaluateFrenet(s);
-			generateCrossTie(fren[3], fren[0], fren[1], fren[2], track->profile.railDistanceToCenter, color, 10, track->profile.tieRadius);
-			i++;
+	// Bounds and quantization origin of a chunk, known from its sample positions before any vertex is written
+	void initChunkBounds(Chunk& chunk, const std::pmr::vector<glm::vec3>& positions, int first, int last) const
+	{
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(std::numeric_limits<float>::lowest());
+		for (int i = first; i <= last; i++) {
+			lo = glm::min(lo, positions[i]);
+			hi = glm::max(hi, positions[i]);
 		}
+		float     reach = profileReach();
+		glm::vec3 halfSize = 0.5f * (hi - lo) + reach;
+
+		chunk.center = 0.5f * (lo + hi);
+		chunk.radius = glm::length(halfSize);
+		chunk.origin = glm::vec4(chunk.center, glm::max(glm::max(halfSize.x, halfSize.y), halfSize.z));
 	}
 
-	void generateWireframeMesh()
-	{
-		if (!track) return;
+	// Samples and chunk layout of a rebuild, allocated from the rebuild's arena. The scratch space of a
+	// chunk is taken from the arena after these and given back once the chunk is done.
+	struct BuildState {
+		explicit BuildState(LinearArena& arena)
+			: arena(arena), positions(&arena), frames(&arena), chunkSamples(&arena)
+		{}
 
-		mesh.data.vertices.clear();
-		mesh.data.indices.clear();
+		LinearArena& arena;
 
-		glm::vec3 tubeColor{ 0, 170, 0 };
-		tubeColor /= 256.0;
-		float tubeRadius = 0.01f;
-		int   verticesPerRing = 15;
-		int   ringsPerNode = 2;
+		std::pmr::vector<glm::vec3>  positions;
+		std::pmr::vector<glm::mat3>  frames;
+		std::pmr::vector<glm::ivec2> chunkSamples; // first and last sample of every chunk
+		int                          sampleCount = 0;
+	};
 
-		std::vector<Vertex>& vertices = mesh.data.vertices;
-		std::vector<uint32_t>& indices = mesh.data.indices;
+	// Samples the track and lays out all chunks with their bounds, but without any geometry yet
+	void beginMesh(BuildState& state)
+	{
+		beginSamples(state);
+		continueSamples(state, std::numeric_limits<int>::max());
+		layoutChunks(state);
+	}
 
-		// TODO: Proper generation
+	// beginMesh() in steps for rebuilds spread over several frames: beginSamples(), continueSamples() by at
+	// most count samples until it returns true, then layoutChunks()
+	void beginSamples(BuildState& state)
+	{
+		chunks.clear();
+		state.chunkSamples.clear();
+		state.positions.clear();
+		state.frames.clear();
+		state.sampleCount = track && track->totalLength() > 0.0f ? sampleCount() : 0;
+
+		// the picking tree is kept, resetBvh() fits it to the new chunks
+		if (state.sampleCount == 0) bvh.clear();
+		state.positions.reserve(state.sampleCount);
+		state.frames.reserve(state.sampleCount);
+	}
 
-		std::vector<glm::vec3> positions;
-		std::vector<glm::mat3> frames;
+	bool continueSamples(BuildState& state, int count)
+	{
+		return state.sampleCount == 0 || appendSamples(state.positions, state.frames, state.sampleCount, count);
+	}
+
+	void layoutChunks(BuildState& state)
+	{
+		if (state.sampleCount == 0) return;
 
 		float totalLength = track->totalLength();
-		int numSamples = static_cast<int>(totalLength / sampleSpacing);
+		int numSamples = state.sampleCount;
+		float ds = totalLength / (numSamples - 1);
 
-		for (int i = 0; i <= numSamples; i++) {
-			float t = (float)i / (float)(numSamples - 1);
-			t = glm::clamp(t, 0.0f, 1.0f);
-			float s = t * totalLength;
-			glm::mat4 fren = track->evaluateFrenet(s);
-			glm::vec3 pos = fren[3];
+		buildSections();
+		int chunkSamples = chunkSampleCount(ds);
 
-			glm::vec3 right = glm::vec3(fren[0]);
-			glm::vec3 up = glm::vec3(fren[1]);
-			glm::vec3 forward = glm::vec3(fren[2]);
+		size_t chunkCount = (numSamples - 2) / chunkSamples + 1;
+		chunks.reserve(chunkCount);
+		state.chunkSamples.reserve(chunkCount);
 
-			positions.push_back(pos);
-			frames.push_back(glm::mat3(right, up, forward));
+		for (int first = 0; first < numSamples - 1; first += chunkSamples) {
+			int  last = std::min(first + chunkSamples, numSamples - 1);
+			bool isLastChunk = last == numSamples - 1;
+
+			Chunk& chunk = chunks.emplace_back();
+			chunk.sBegin = first * ds;
+			chunk.sEnd = isLastChunk ? totalLength : last * ds;
+			initChunkBounds(chunk, state.positions, first, last);
+			state.chunkSamples.emplace_back(first, last);
 		}
+		resetBvh();
+	}
 
-		generateTube(positions, frames, glm::vec2(-track->profile.railDistanceToCenter, 0.0f), 0.0f, 1, tubeColor);
-		generateTube(positions, frames, glm::vec2(track->profile.railDistanceToCenter, 0.0f), 0.0f, 1, tubeColor);
+	// Builds all LOD levels of one chunk laid out by beginMesh(), chunks are independent of each other
+	void generateChunk(size_t index, BuildState& state)
+	{
+		LinearArena::Scope scratch(state.arena);
+
+		Chunk& chunk = chunks[index];
+		int  first = state.chunkSamples[index].x;
+		int  last = state.chunkSamples[index].y;
+
+		// cross ties starting in this chunk, shared by all levels that have ties
+		std::pmr::vector<glm::mat4> ties(&state.arena);
+		std::pmr::vector<float>     tieS(&state.arena);
+		ties.reserve((size_t)((chunk.sEnd - chunk.sBegin) / tieEvery) + 2);
+		tieS.reserve(ties.capacity());
+		collectTies(chunk, index + 1 == chunks.size(), ties, tieS);
+
+		std::pmr::vector<glm::vec3> lodPositions(&state.arena);
+		std::pmr::vector<glm::mat3> lodFrames(&state.arena);
+		std::pmr::vector<float>     lodS(&state.arena);
+		lodPositions.reserve(last - first + 1);
+		lodFrames.reserve(last - first + 1);
+		lodS.reserve(last - first + 1);
+		float ds = (chunk.sEnd - chunk.sBegin) / (last - first);
+
+		auto& data = chunk.mesh.data;
+		reserveChunkGeometry(chunk, last - first, ties.size());
+		for (int l = 0; l < LOD_COUNT; l++) {
+			const LodLevel& level = lodLevels[l];
+			DrawRange& range = chunk.lods[l];
+			range.firstIndex = data.indices.size();
+			range.vertexOffset = data.vertices.size();
+
+			const LodSections& lodSections = sections[l];
+
+			lodPositions.clear();
+			lodFrames.clear();
+			lodS.clear();
+			for (int i = first; ; i = std::min(i + level.ringStride, last)) {
+				lodPositions.push_back(state.positions[i]);
+				lodFrames.push_back(state.frames[i]);
+				lodS.push_back(i == last ? chunk.sEnd : chunk.sBegin + (i - first) * ds);
+				if (i == last) break;
+			}
+			const glm::vec3* positions = lodPositions.data();
+			const glm::mat3* frames = lodFrames.data();
+			const float*     ringS = lodS.data();
+			size_t rings = lodPositions.size();
 
-		generateTube(positions, frames, glm::vec2(0.0f, -track->profile.mainSplineOffset), 0.0f, 1, tubeColor);
+			extrudeSection(chunk, range, positions, frames, ringS, rings, glm::vec2(-track->profile.railDistanceToCenter, 0.0f), lodSections.rail);
+			extrudeSection(chunk, range, positions, frames, ringS, rings, glm::vec2(track->profile.railDistanceToCenter, 0.0f), lodSections.rail);
 
-		// cross ties
-		int i = 0;
-		float s = 0.0f;
-		while ((s = i * tieEvery) <= totalLength) {
-			glm::mat4 fren = track->evaluateFrenet(s);
-			generateCrossTie(fren[3], fren[0], fren[1], fren[2], track->profile.railDistanceToCenter, tubeColor, 1, 0.0f);
-			i++;
+			extrudeSection(chunk, range, positions, frames, ringS, rings, glm::vec2(0.0f, -track->profile.mainSplineOffset), lodSections.spine);
+
+			if (level.tieSegments > 0) {
+				for (size_t t = 0; t < ties.size(); t++) {
+					const glm::mat4& fren = ties[t];
+					generateCrossTie(chunk, range, fren[3], fren[0], fren[1], fren[2], tieS[t], track->profile.railDistanceToCenter, lodSections.tie);
+				}
+			}
+
+			range.indexCount = data.indices.size() - range.firstIndex;
+			computeNormalCone(chunk, range);
+		}
+
+		chunk.attributes.assign(data.vertices.size(), TrackVertexAttributes{});
+		optimizeChunkIndices(chunk, state.arena);
+		bvh.setChunk(index, &state.positions[first], &state.frames[first], last - first + 1, chunk.sBegin, chunk.sEnd);
+	}
+
+	void resetBvh()
+	{
+		const auto& profile = track->profile;
+		bvh.setTubes(profile.railDistanceToCenter, profile.runningRailRadius, profile.mainSplineOffset, profile.mainSplineRadius);
+		bvh.resize(chunks.size());
+	}
+
+	// Stops early when stop is requested, the mesh is incomplete then and meant to be discarded.
+	// Temporaries come from arena, which is reset first. Passing the same arena to every rebuild
+	// keeps them off the heap once it has grown to the size of the largest rebuild.
+	void generateMesh(std::stop_token stop = {}, LinearArena* arena = nullptr)
+	{
+		LinearArena localArena;
+		if (!arena) arena = &localArena;
+		arena->reset();
+
+		BuildState state(*arena);
+		beginMesh(state);
+
+		for (size_t c = 0; c < chunks.size(); c++) {
+			if (stop.stop_requested()) return;
+			generateChunk(c, state);
+		}
+		updateIndexStats();
+	}
+
+	// Sizes the chunk's vertex, index and attribute run buffers for all levels up front, counting like extrudeSection()
+	void reserveChunkGeometry(Chunk& chunk, int intervals, size_t tieCount) const
+	{
+		auto quads = [](const ProfileSection& section) {
+			return (size_t)std::count(section.connectNext.begin(), section.connectNext.end(), 1);
+		};
+
+		size_t vertices = 0;
+		size_t indices = 0;
+		size_t runs = 0;
+		for (int l = 0; l < LOD_COUNT; l++) {
+			const LodSections& lodSections = sections[l];
+			size_t rings = (intervals + lodLevels[l].ringStride - 1) / lodLevels[l].ringStride + 1;
+
+			vertices += rings * (2 * lodSections.rail.count + lodSections.spine.count);
+			indices += 6 * (rings - 1) * (2 * quads(lodSections.rail) + quads(lodSections.spine));
+			runs += 3 * rings;
+			if (lodLevels[l].tieSegments > 0) {
+				vertices += tieCount * 3 * 2 * lodSections.tie.count;
+				indices += tieCount * 3 * 6 * quads(lodSections.tie);
+				runs += tieCount;
+			}
+		}
+		chunk.mesh.data.vertices.reserve(vertices);
+		chunk.mesh.data.indices.reserve(indices);
+		chunk.attributeRuns.reserve(runs);
+	}
+
+	// Normal cone as in meshoptimizer's meshopt_computeMeshletBounds: the axis is the average triangle normal
+	// and the cutoff the sine of the largest angle between it and any triangle normal. Cones of 90 degrees or
+	// wider get a cutoff of 1, which no view direction passes.
+	void computeNormalCone(const Chunk& chunk, DrawRange& range) const
+	{
+		const auto& data = chunk.mesh.data;
+		auto triangleNormal = [&](uint32_t t) {
+			const Index* tri = data.indices.data() + range.firstIndex + 3 * t;
+			glm::vec3 p0 = data.vertices[range.vertexOffset + tri[0]].decodePosition(chunk.origin);
+			glm::vec3 p1 = data.vertices[range.vertexOffset + tri[1]].decodePosition(chunk.origin);
+			glm::vec3 p2 = data.vertices[range.vertexOffset + tri[2]].decodePosition(chunk.origin);
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float len = glm::length(n);
+			return len > 0.0f ? n / len : glm::vec3(0.0f);
+		};
+
+		uint32_t  triangles = range.indexCount / 3;
+		glm::vec3 axis(0.0f);
+		for (uint32_t t = 0; t < triangles; t++) {
+			axis += triangleNormal(t);
+		}
+
+		range.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		range.coneCutoff = 1.0f;
+		float len = glm::length(axis);
+		if (len <= 0.0f) return;
+		axis /= len;
+
+		float minDot = 1.0f;
+		for (uint32_t t = 0; t < triangles && minDot > 0.0f; t++) {
+			glm::vec3 n = triangleNormal(t);
+			if (n != glm::vec3(0.0f)) minDot = glm::min(minDot, glm::dot(axis, n));
+		}
+		if (minDot <= 0.0f) return;
+
+		range.coneAxis = axis;
+		range.coneCutoff = glm::sqrt(1.0f - minDot * minDot);
+	}
+
+	uint32_t rangeVertexCount(const Chunk& chunk, int lod) const
+	{
+		uint32_t end = (lod + 1 < LOD_COUNT) ? chunk.lods[lod + 1].vertexOffset : chunk.mesh.data.vertices.size();
+		return end - chunk.lods[lod].vertexOffset;
+	}
+
+	// Runs Tipsify and optionally the overdraw cluster sort on every LOD range of the chunk
+	void optimizeChunkIndices(Chunk& chunk, LinearArena& arena) const
+	{
+		chunk.acmrBefore = 0.0f;
+		chunk.acmrAfter = 0.0f;
+		chunk.triangles = 0;
+
+		auto& data = chunk.mesh.data;
+		for (int l = 0; l < LOD_COUNT; l++) {
+			const DrawRange& range = chunk.lods[l];
+			if (range.indexCount < 3) continue;
+
+			LinearArena::Scope scratch(arena);
+
+			Index*    indices = data.indices.data() + range.firstIndex;
+			uint32_t  vertexCount = rangeVertexCount(chunk, l);
+			uint32_t  triangles = range.indexCount / 3;
+
+			chunk.acmrBefore += computeAcmr(indices, range.indexCount, vertexCount, VERTEX_CACHE_SIZE, &arena) * triangles;
+			if (optimizeVertexCache) {
+				std::pmr::vector<uint32_t> clusterStarts(&arena);
+				clusterStarts.reserve(triangles + 1);
+				tipsify(indices, range.indexCount, vertexCount, VERTEX_CACHE_SIZE, reduceOverdraw ? &clusterStarts : nullptr, &arena);
+
+				if (reduceOverdraw) {
+					std::pmr::vector<glm::vec3> decodedPositions(vertexCount, &arena);
+					for (uint32_t v = 0; v < vertexCount; v++) {
+						decodedPositions[v] = data.vertices[range.vertexOffset + v].decodePosition(chunk.origin);
+					}
+					osp::optimizeOverdraw(indices, range.indexCount, decodedPositions.data(), clusterStarts, &arena);
+				}
+			}
+			chunk.acmrAfter += computeAcmr(indices, range.indexCount, vertexCount, VERTEX_CACHE_SIZE, &arena) * triangles;
+			chunk.triangles += triangles;
+		}
+		if (chunk.triangles > 0) {
+			chunk.acmrBefore /= chunk.triangles;
+			chunk.acmrAfter /= chunk.triangles;
+		}
+	}
+
+	void updateIndexStats()
+	{
+		indexStats = {};
+		size_t totalTriangles = 0;
+		for (const Chunk& chunk : chunks) {
+			indexStats.acmrBefore += chunk.acmrBefore * chunk.triangles;
+			indexStats.acmrAfter += chunk.acmrAfter * chunk.triangles;
+			totalTriangles += chunk.triangles;
+		}
+		if (totalTriangles > 0) {
+			indexStats.acmrBefore /= totalTriangles;
+			indexStats.acmrAfter /= totalTriangles;
+		}
+	}
+
+	// Picks the LOD of every chunk from its projected diameter on screen. A chunk only changes level
+	// once its size leaves the hysteresis band around the switch size, so it does not flicker
+	// between two levels when the camera rests near a boundary.
+	void selectLods(const glm::mat4& view, float fovY, float viewportHeight)
+	{
+		glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+		float pixelsPerUnit = viewportHeight / (2.0f * glm::tan(0.5f * fovY));
+
+		for (Chunk& chunk : chunks) {
+			float dist = glm::distance(eye, chunk.center);
+			float size = dist > chunk.radius ? 2.0f * chunk.radius * pixelsPerUnit / dist : std::numeric_limits<float>::max();
+
+			int lod = chunk.lod;
+			while (lod < LOD_COUNT - 1 && size < lodSwitchPixels[lod] * (1.0f - lodHysteresis)) lod++;
+			while (lod > 0 && size > lodSwitchPixels[lod - 1] * (1.0f + lodHysteresis)) lod--;
+			chunk.lod = lod;
 		}
+	}
 
+	// Frustum culls the chunk bounding spheres and backface culls the normal cone of each chunk's current level,
+	// so it runs after selectLods(). proj maps to Vulkan clip space (depth 0 to 1).
+	void cull(const glm::mat4& view, const glm::mat4& proj)
+	{
+		glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+		glm::mat4 rows = glm::transpose(proj * view);
+
+		// inward facing planes: left, right, bottom, top, near, far
+		std::array<glm::vec4, 6> planes = {
+			rows[3] + rows[0], rows[3] - rows[0],
+			rows[3] + rows[1], rows[3] - rows[1],
+			rows[2],           rows[3] - rows[2] };
+		for (glm::vec4& plane : planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
 
+		visibleChunks = 0;
+		for (Chunk& chunk : chunks) {
+			chunk.visible = true;
+			for (const glm::vec4& plane : planes) {
+				if (glm::dot(glm::vec3(plane), chunk.center) + plane.w < -chunk.radius) {
+					chunk.visible = false;
+					break;
+				}
+			}
 
+			const DrawRange& range = chunk.lods[chunk.lod];
+			glm::vec3 toChunk = chunk.center - eye;
+			float     dist = glm::length(toChunk);
+			if (chunk.visible && range.coneCutoff < 1.0f && dist > chunk.radius) {
+				chunk.visible = glm::dot(toChunk / dist, range.coneAxis) < range.coneCutoff + chunk.radius / dist;
+			}
+			if (chunk.visible) visibleChunks++;
+		}
+	}
 
+	// Appends the polyline through samples [first, last], offset in the track frame, as line list
+	void generatePolyline(
+		Chunk& chunk, const DrawRange& range,
+		const std::pmr::vector<glm::vec3>& positions,
+		const std::pmr::vector<glm::mat3>& frames,
+		int first, int last, glm::vec2 offset)
+	{
+		auto& vertices = chunk.mesh.data.vertices;
+		auto& indices = chunk.mesh.data.indices;
 
+		uint32_t baseVertex = vertices.size() - range.vertexOffset;
 
+		for (int i = first; i <= last; i++) {
+			glm::vec3 right = frames[i][0];
+			glm::vec3 up = frames[i][1];
+			glm::vec3 pos = positions[i] + offset.x * right + offset.y * up;
 
+			float s = i == last ? chunk.sEnd : glm::mix(chunk.sBegin, chunk.sEnd, (float)(i - first) / (last - first));
+			addAttributeRun(chunk, vertices.size(), 1, s);
 
+			vertices.push_back(TrackVertex::encode(pos, up, glm::vec2(0.0f, (float)(i - first) / (last - first)), chunk.origin));
 
+			if (i == last) continue;
+			uint32_t a = baseVertex + (i - first);
+			indices.push_back(static_cast<Index>(a));
+			indices.push_back(static_cast<Index>(a + 1));
+		}
+	}
 
+	// Appends the three beams of a cross tie (rail to rail, both rails to the spine) as line list
+	void generateTieLines(Chunk& chunk, const DrawRange& range, const glm::mat4& fren, float s, float railOffset)
+	{
+		auto& vertices = chunk.mesh.data.vertices;
+		auto& indices = chunk.mesh.data.indices;
 
-		//const size_t numNodes = track->curve->getNumControlNodes();
+		glm::vec3 center = fren[3];
+		glm::vec3 right = fren[0];
+		glm::vec3 up = fren[1];
 
-		//for (int i = 0; i < numNodes; i++)
-		//{
-		//	glm::vec3 position = track->curve->getControlPoint(i);
-		//	// Construct Frenet Frame
-		//	glm::vec3 forward = nodeTangents[i]->clone();
-		//	forward = glm::normalize(nodeTangents[i]);
+		uint32_t baseVertex = vertices.size() - range.vertexOffset;
+		addAttributeRun(chunk, vertices.size(), 3, s);
+		vertices.push_back(TrackVertex::encode(center - right * railOffset, up, glm::vec2(0.0f), chunk.origin));
+		vertices.push_back(TrackVertex::encode(center + right * railOffset, up, glm::vec2(1.0f, 0.0f), chunk.origin));
+		vertices.push_back(TrackVertex::encode(center - up * track->profile.mainSplineOffset, up, glm::vec2(0.5f, 1.0f), chunk.origin));
 
-		//	glm::mat3 rotation = glm::rotate(glm::radians((float)nodeRoll[i]), forward);
-		//	glm::vec3 right = rotation * glm::normalize(glm::cross(forward, UP_DIR));
-		//	glm::vec3 up = -glm::normalize(glm::cross(forward, right));
+		for (uint32_t line : { 0u, 1u, 0u, 2u, 1u, 2u }) {
+			indices.push_back(static_cast<Index>(baseVertex + line));
+		}
+	}
 
-		//	// Construct Geometry
-		//	vertices.push_back({ nodePositions[i] -    up * 0.1, tubeColor, {0.0, 0.0}, -up });
-		//	vertices.push_back({ nodePositions[i] + right * 0.1, tubeColor, {0.0, 0.0},  up });
-		//	vertices.push_back({ nodePositions[i] - right * 0.1, tubeColor, {0.0, 0.0},  up });
+	// Rails, spine and ties as plain lines, drawn with a line list pipeline. There is no LOD chain,
+	// every level of a chunk refers to the same range.
+	void generateWireframeMesh(std::stop_token stop = {})
+	{
+		chunks.clear();
+		bvh.clear();
+		if (!track || track->totalLength() <= 0.0f) return;
 
-		//	// Inner Beams
-		//	indices.push_back(3 * (i + 0) + 0);
-		//	indices.push_back(3 * (i + 0) + 1);
-		//	indices.push_back(3 * (i + 0) + 1);
+		color = glm::vec3{ 0, 170, 0 };
+		color /= 256.0;
 
-		//	indices.push_back(3 * (i + 0) + 1);
-		//	indices.push_back(3 * (i + 0) + 2);
-		//	indices.push_back(3 * (i + 0) + 2);
+		std::pmr::vector<glm::vec3> positions;
+		std::pmr::vector<glm::mat3> frames;
+		std::pmr::vector<glm::mat4> ties;
+		std::pmr::vector<float>     tieS;
 
-		//	indices.push_back(3 * (i + 0) + 2);
-		//	indices.push_back(3 * (i + 0) + 0);
-		//	indices.push_back(3 * (i + 0) + 0);
+		float totalLength = track->totalLength();
+		int numSamples = sampleTrack(positions, frames);
+		float ds = totalLength / (numSamples - 1);
 
-		//	if (i == nodePositions.size() - 1)
-		//	{
-		//		break;
-		//	}
+		for (int first = 0; first < numSamples - 1; first += samplesPerChunk) {
+			if (stop.stop_requested()) return;
 
-		//	// Tangent Beams
-		//	indices.push_back(3 * (i + 0) + 0);
-		//	indices.push_back(3 * (i + 1) + 0);
-		//	indices.push_back(3 * (i + 1) + 0);
+			int  last = std::min(first + samplesPerChunk, numSamples - 1);
+			bool isLastChunk = last == numSamples - 1;
 
-		//	indices.push_back(3 * (i + 0) + 1);
-		//	indices.push_back(3 * (i + 1) + 1);
-		//	indices.push_back(3 * (i + 1) + 1);
+			Chunk& chunk = chunks.emplace_back();
+			chunk.sBegin = first * ds;
+			chunk.sEnd = isLastChunk ? totalLength : last * ds;
+			initChunkBounds(chunk, positions, first, last);
 
-		//	indices.push_back(3 * (i + 0) + 2);
-		//	indices.push_back(3 * (i + 1) + 2);
-		//	indices.push_back(3 * (i + 1) + 2);
+			DrawRange range{};
+			generatePolyline(chunk, range, positions, frames, first, last, glm::vec2(-track->profile.railDistanceToCenter, 0.0f));
+			generatePolyline(chunk, range, positions, frames, first, last, glm::vec2(track->profile.railDistanceToCenter, 0.0f));
 
-		//	continue;
+			generatePolyline(chunk, range, positions, frames, first, last, glm::vec2(0.0f, -track->profile.mainSplineOffset));
 
-		//	// SIDE A
-		//	indices.push_back(3 * (i+0) + 0);
-		//	indices.push_back(3 * (i+1) + 1);
-		//	indices.push_back(3 * (i+0) + 1);
+			collectTies(chunk, isLastChunk, ties, tieS);
+			for (size_t t = 0; t < ties.size(); t++) {
+				generateTieLines(chunk, range, ties[t], tieS[t], track->profile.railDistanceToCenter);
+			}
 
-		//	indices.push_back(3 * (i+0) + 0);
-		//	indices.push_back(3 * (i+1) + 0);
-		//	indices.push_back(3 * (i+1) + 1);
+			range.indexCount = chunk.mesh.data.indices.size();
+			chunk.attributes.assign(chunk.mesh.data.vertices.size(), TrackVertexAttributes{});
+			chunk.lods.fill(range);
+		}
 
-		//	// SIDE B
-		//	indices.push_back(3 * (i + 0) + 1);
-		//	indices.push_back(3 * (i + 1) + 2);
-		//	indices.push_back(3 * (i + 0) + 2);
+		resetBvh();
+		for (size_t c = 0; c < chunks.size(); c++) {
+			int first = (int)c * samplesPerChunk;
+			int last = std::min(first + samplesPerChunk, numSamples - 1);
+			bvh.setChunk(c, &positions[first], &frames[first], last - first + 1, chunks[c].sBegin, chunks[c].sEnd);
+		}
+	}
+
+	DrawConstants drawConstants(const Chunk& chunk) const
+	{
+		return { chunk.origin, glm::vec4(color, 1.0f) };
+	}
+
+	// Rewrites the attribute stream of every chunk, chunks are filled in parallel.
+	// The geometry is left alone, uploadAttributes() then only transfers the attribute buffers.
+	void applyColoring(const TrackColoring& coloring)
+	{
+		parallelFor(chunks.size(), [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; c++) {
+				applyColoring(chunks[c], coloring);
+			}
+		});
+	}
 
-		//	indices.push_back(3 * (i + 0) + 1);
-		//	indices.push_back(3 * (i + 1) + 1);
-		//	indices.push_back(3 * (i + 1) + 2);
+	static void applyColoring(Chunk& chunk, const TrackColoring& coloring)
+	{
+		for (const AttributeRun& run : chunk.attributeRuns) {
+			TrackVertexAttributes attributes = coloring.attributesAt(run.s);
+			std::fill_n(chunk.attributes.begin() + run.firstVertex, run.count, attributes);
+		}
+	}
 
-		//	// SIDE C
-		//	indices.push_back(3 * (i + 0) + 2);
-		//	indices.push_back(3 * (i + 1) + 0);
-		//	indices.push_back(3 * (i + 0) + 0);
+	// Queues the chunk's buffers, usable by anything submitted after the next uploads.submit()
+	static void uploadChunk(Chunk& chunk, UploadQueue& uploads)
+	{
+		if (chunk.mesh.data.indices.empty()) return;
+		chunk.mesh.upload(uploads);
+		uploads.upload(chunk.attributeBuffer, sizeof(TrackVertexAttributes) * chunk.attributes.size(), vk::BufferUsageFlagBits::eVertexBuffer, chunk.attributes.data());
+	}
 
-		//	indices.push_back(3 * (i + 0) + 2);
-		//	indices.push_back(3 * (i + 1) + 2);
-		//	indices.push_back(3 * (i + 1) + 0);
-		//}
+	void upload(UploadQueue& uploads)
+	{
+		for (Chunk& chunk : chunks) {
+			uploadChunk(chunk, uploads);
+		}
 	}
 
-	void upload(VkContext& context, vk::raii::CommandPool& commandPool)
+	// Only the attribute buffers, into the buffers created by upload(). Frames still drawing the mesh finish first, see UploadQueue.
+	void uploadAttributes(UploadQueue& uploads)
 	{
-		mesh.upload(context, commandPool);
+		for (Chunk& chunk : chunks) {
+			if (chunk.mesh.data.indices.empty()) continue;
+			uploads.update(chunk.attributeBuffer, sizeof(TrackVertexAttributes) * chunk.attributes.size(), chunk.attributes.data());
+		}
 	}
 };
 
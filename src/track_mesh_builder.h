@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+#include "track_mesh.h"
+
+namespace osp
+{
+
+// Rebuilds a TrackMesh on the render thread a piece at a time. Every advance() works until its time budget is
+// used up and picks up from there on the next call: it updates the track's curve, transport frames and
+// slopes, samples the track, lays out the chunks and then generates and uploads them. Chunks closest to one
+// of the focus points (camera, edited node) are built first.
+class TrackMeshBuilder
+{
+public:
+	std::unique_ptr<TrackMesh> mesh;  // the mesh being built, chunk i is usable once built[i] is set
+	std::vector<bool>          built; // empty until the chunks are laid out
+	const TrackColoring*       coloring = nullptr; // applied to every chunk before it is uploaded
+
+	// Samples of the track per step between two looks at the clock
+	static constexpr int SAMPLES_PER_STEP = 256;
+
+	bool active() const
+	{
+		return mesh != nullptr;
+	}
+
+	// Whether the track's transport frames and slopes are up to date, anything derived from them can be refreshed then
+	bool trackUpdated() const
+	{
+		return active() && phase >= Phase::Samples;
+	}
+
+	// Only remembers what to build, all of the work happens in advance()
+	void start(Track* track, const std::vector<glm::vec3>& focusPoints)
+	{
+		mesh = std::make_unique<TrackMesh>();
+		mesh->track = track;
+		mesh->bvh = std::move(recycledBvh);
+		focus = focusPoints;
+
+		state.reset();
+		arena.reset();
+		state.emplace(arena);
+		built.clear();
+		order.clear();
+		next = 0;
+		phase = Phase::Curve;
+	}
+
+	// Stops the rebuild and hands back the partly built mesh
+	std::unique_ptr<TrackMesh> cancel()
+	{
+		state.reset();
+		built.clear();
+		return std::move(mesh);
+	}
+
+	// Works until budgetMs is used up, at least one step per call, and submits the uploads of its chunks.
+	// Returns early once the track is updated, so the caller can refresh what depends on it, e.g. the
+	// coloring, before any chunk is built. Returns true once every chunk is built.
+	bool advance(UploadQueue& uploads, float budgetMs)
+	{
+		using clock = std::chrono::steady_clock;
+		auto deadline = clock::now() + std::chrono::duration<float, std::milli>(budgetMs);
+
+		do {
+			if (phase != Phase::Chunks) {
+				if (!prepare()) break;
+				continue;
+			}
+			if (next == order.size()) break;
+
+			uint32_t c = order[next++];
+			mesh->generateChunk(c, *state);
+
+			TrackMesh::Chunk& chunk = mesh->chunks[c];
+			if (coloring) {
+				TrackMesh::applyColoring(chunk, *coloring);
+			}
+			TrackMesh::uploadChunk(chunk, uploads);
+			built[c] = true;
+		} while (clock::now() < deadline);
+		uploads.submit();
+
+		return phase == Phase::Chunks && next == order.size();
+	}
+
+	// Hands over the finished mesh
+	std::unique_ptr<TrackMesh> finish()
+	{
+		mesh->updateIndexStats();
+		state.reset();
+		built.clear();
+		return std::move(mesh);
+	}
+
+	size_t builtCount() const
+	{
+		return next;
+	}
+
+	// The picking tree of a replaced mesh, the next rebuild refits it instead of building its own
+	void recycle(TrackBvh&& bvh)
+	{
+		recycledBvh = std::move(bvh);
+	}
+
+	// Temporaries of the current or last rebuild
+	const LinearArena::Stats& arenaStats() const
+	{
+		return arena.getStats();
+	}
+
+private:
+	enum class Phase {
+		Curve,
+		TransportFrames,
+		Slopes,
+		Samples,
+		Chunks
+	};
+
+	Phase                  phase = Phase::Curve;
+	std::vector<glm::vec3> focus;
+
+	// Built aside and swapped into the track once complete, so it never sees half of them
+	std::vector<Track::TransportFrame> transportFrames;
+	SlopeTable                         slopes;
+
+	// Kept across rebuilds, so its memory is reused instead of allocated anew each time
+	LinearArena                          arena;
+	std::optional<TrackMesh::BuildState> state;
+	std::vector<uint32_t> order;
+	size_t                next = 0;
+	TrackBvh              recycledBvh;
+
+	// One step of the work before the chunks, returns false once the track is updated
+	bool prepare()
+	{
+		Track& track = *mesh->track;
+		switch (phase) {
+		case Phase::Curve:
+			track.curve->update();
+			transportFrames.clear();
+			phase = Phase::TransportFrames;
+			return true;
+
+		case Phase::TransportFrames:
+			if (track.propagateTransportFrames(transportFrames, SAMPLES_PER_STEP)) {
+				slopes.begin(*track.curve);
+				phase = Phase::Slopes;
+			}
+			return true;
+
+		case Phase::Slopes:
+			if (!slopes.extend(*track.curve, SAMPLES_PER_STEP)) return true;
+			// both go in together, the simulation reads them every frame
+			track.transportFrames.swap(transportFrames);
+			std::swap(track.slopes, slopes);
+			mesh->beginSamples(*state);
+			phase = Phase::Samples;
+			return false;
+
+		case Phase::Samples:
+			if (mesh->continueSamples(*state, SAMPLES_PER_STEP)) {
+				mesh->layoutChunks(*state);
+				orderChunks();
+				phase = Phase::Chunks;
+			}
+			return true;
+
+		case Phase::Chunks:
+			break;
+		}
+		return true;
+	}
+
+	void orderChunks()
+	{
+		built.assign(mesh->chunks.size(), false);
+		order.resize(mesh->chunks.size());
+		std::iota(order.begin(), order.end(), 0);
+
+		std::vector<float> priority(order.size(), std::numeric_limits<float>::max());
+		for (size_t c = 0; c < order.size(); c++) {
+			for (const glm::vec3& point : focus) {
+				priority[c] = glm::min(priority[c], glm::distance(point, mesh->chunks[c].center) - mesh->chunks[c].radius);
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return priority[a] < priority[b]; });
+		next = 0;
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stop_token>
+#include <thread>
+
+#include "spsc_slot.h"
+#include "track.h"
+#include "track_mesh.h"
+
+namespace osp
+{
+
+// Generates track meshes on a background thread from snapshots of the track. A newer submit() cancels
+// the job in progress, finished meshes come back through poll() without any GPU resources, uploading
+// them stays with the render thread.
+class TrackMeshWorker
+{
+public:
+	struct Result {
+		std::unique_ptr<Track>     track; // the snapshot the mesh was built from, including its transport frames
+		std::unique_ptr<TrackMesh> mesh;
+		bool                       wireframe = false;
+		uint64_t                   generation = 0;
+		LinearArena::Stats         arenaStats; // temporaries of the rebuild
+	};
+
+	TrackMeshWorker()
+	{
+		thread = std::jthread([this](std::stop_token stop) { run(stop); });
+	}
+
+	~TrackMeshWorker()
+	{
+		currentJob.request_stop();
+		thread.request_stop();
+		wake();
+	}
+
+	TrackMeshWorker(const TrackMeshWorker&) = delete;
+	TrackMeshWorker& operator=(const TrackMeshWorker&) = delete;
+
+	// Render thread: queues the snapshot, dropping whatever was queued or being meshed before
+	void submit(std::unique_ptr<Track> snapshot, bool wireframe)
+	{
+		currentJob.request_stop();
+		currentJob = std::stop_source();
+
+		auto job = std::make_unique<Job>(Job{ std::move(snapshot), wireframe, currentJob.get_token(), ++generation });
+		if (!wireframe) job->bvh = std::move(recycledBvh);
+		jobs.publish(std::move(job));
+		wake();
+	}
+
+	// Render thread: the picking tree of a replaced mesh, the next rebuild refits it instead of building its own
+	void recycle(TrackBvh&& bvh)
+	{
+		recycledBvh = std::move(bvh);
+	}
+
+	// Render thread: drops the job in progress and any result not polled yet
+	void cancel()
+	{
+		currentJob.request_stop();
+		delivered = ++generation;
+	}
+
+	// Render thread: the mesh of the latest submit() once it is done, results of older snapshots are dropped
+	std::unique_ptr<Result> poll()
+	{
+		std::unique_ptr<Result> result = results.take();
+		if (!result || result->generation != generation) return nullptr;
+
+		delivered = result->generation;
+		return result;
+	}
+
+	// Render thread: a submitted snapshot has not come back yet
+	bool pending() const
+	{
+		return delivered != generation;
+	}
+
+private:
+	struct Job {
+		std::unique_ptr<Track> track;
+		bool                   wireframe = false;
+		std::stop_token        stop;
+		uint64_t               generation = 0;
+		TrackBvh               bvh;
+	};
+
+	void wake()
+	{
+		submitted.fetch_add(1, std::memory_order_release);
+		submitted.notify_one();
+	}
+
+	void run(std::stop_token stop)
+	{
+		uint64_t seen = 0;
+		while (!stop.stop_requested()) {
+			submitted.wait(seen, std::memory_order_acquire);
+			seen = submitted.load(std::memory_order_acquire);
+
+			std::unique_ptr<Job> job = jobs.take();
+			if (!job || job->stop.stop_requested()) continue;
+
+			auto result = std::make_unique<Result>();
+			result->track = std::move(job->track);
+			result->wireframe = job->wireframe;
+			result->generation = job->generation;
+
+			result->track->update();
+			result->mesh = std::make_unique<TrackMesh>();
+			result->mesh->track = result->track.get();
+			result->mesh->bvh = std::move(job->bvh);
+			if (job->wireframe) {
+				result->mesh->generateWireframeMesh(job->stop);
+			}
+			else {
+				result->mesh->generateMesh(job->stop, &arena);
+				result->arenaStats = arena.getStats();
+			}
+
+			if (job->stop.stop_requested()) continue;
+			results.publish(std::move(result));
+		}
+	}
+
+	// render thread only
+	std::stop_source currentJob;
+	uint64_t         generation = 0;
+	uint64_t         delivered = 0;
+	TrackBvh         recycledBvh;
+
+	SpscSlot<Job>         jobs;    // render thread -> worker
+	SpscSlot<Result>      results; // worker -> render thread
+	std::atomic<uint64_t> submitted{ 0 };
+
+	// worker thread only, reused by every rebuild
+	LinearArena arena;
+
+	// declared last so it is joined before the slots go away
+	std::jthread thread;
+};
+
+} // namespace osp
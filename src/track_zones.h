@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace osp
+{
+
+// A typed section of the track, active while the front of the train is between start and end
+struct TrackZone
+{
+	enum class Type {
+		Lift,          // chain takes the train up to speed and holds it there, it can't go slower
+		Launch,        // linear synchronous motors accelerate by force m/s^2 up to speed
+		MagneticBrake, // eddy currents decelerate by force 1/s per m/s above speed
+		BlockBrake     // friction brakes decelerate by force m/s^2 to speed, at 0 they stop and hold the train
+	};
+	static constexpr std::array<const char*, 4> TYPE_NAMES = { "Lift", "Launch", "Magnetic Brake", "Block Brake" };
+	static constexpr std::array<const char*, 4> TYPE_KEYS = { "lift", "launch", "magneticBrake", "blockBrake" }; // in the track YAML
+
+	Type  type = Type::Lift;
+	float start = 0.0f;
+	float end = 0.0f;
+	float speed = 2.5f; // m/s
+	float force = 0.0f;
+
+	// How fast a lift's chain closes the gap to its speed, 1/s. The pull is continuous in the speed so the
+	// integrator's error estimate sees it.
+	static constexpr double LIFT_CATCH_RATE = 2.0;
+
+	// Whether the zone moves a train that would stand still or roll back
+	bool propels() const
+	{
+		return type == Type::Lift || type == Type::Launch;
+	}
+
+	// Acceleration of a train at speed v with the zone acting on top of a
+	double accelerate(double v, double a) const
+	{
+		if (type == Type::Lift) {
+			a = std::max(a, LIFT_CATCH_RATE * (speed - v)); // at speed this holds the train against gravity
+		}
+		else if (type == Type::Launch && v < speed) {
+			a += force;
+		}
+		else if (type == Type::MagneticBrake && v > speed) {
+			a -= force * (v - speed);
+		}
+		else if (type == Type::BlockBrake) {
+			if (v > speed) a -= force;
+			else if (speed <= 0.0f) a = std::abs(a) <= force ? 0.0 : a - std::copysign(force, a); // holding
+		}
+		return a;
+	}
+
+	// Speed after stopping brakes, for states the integration arrives at. Friction can't reverse the train.
+	double constrain(double v) const
+	{
+		if (type == Type::BlockBrake && speed <= 0.0f) return std::max(v, 0.0);
+		return v;
+	}
+
+	static bool parseType(std::string_view key, Type& type)
+	{
+		for (size_t i = 0; i < TYPE_KEYS.size(); i++) {
+			if (key == TYPE_KEYS[i]) {
+				type = static_cast<Type>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// The zones of a track with an index over s. build() splits the track at every zone boundary into
+// intervals and lists the zones active in each, so a lookup is one search over the sorted boundaries.
+// Trains move little between lookups, so each keeps a Cursor on its last interval and usually finds s
+// there or next to it without searching, however many zones the track has.
+class TrackZones
+{
+public:
+	std::vector<TrackZone> zones; // edited directly, build() afterwards
+
+	struct Cursor {
+		size_t interval = 0;
+	};
+
+	// The zones active at s, as indices into zones
+	struct Active {
+		const uint32_t* first = nullptr;
+		const uint32_t* last = nullptr;
+
+		const uint32_t* begin() const { return first; }
+		const uint32_t* end() const { return last; }
+		bool empty() const { return first == last; }
+	};
+
+	// Chain lift over the first 30 m, what tracks without zones get
+	static TrackZones defaultLift()
+	{
+		TrackZones result;
+		result.zones.push_back({ TrackZone::Type::Lift, 0.0f, 30.0f, 2.5f, 0.0f });
+		result.build();
+		return result;
+	}
+
+	void build()
+	{
+		bounds.clear();
+		for (const TrackZone& zone : zones) {
+			if (zone.end <= zone.start) continue;
+			bounds.push_back(zone.start);
+			bounds.push_back(zone.end);
+		}
+		std::sort(bounds.begin(), bounds.end());
+		bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+		// interval i is [bounds[i], bounds[i + 1]), inclusive at the end of the last one
+		size_t intervals = bounds.size() > 1 ? bounds.size() - 1 : 0;
+		offsets.assign(intervals + 1, 0);
+		active.clear();
+		for (size_t i = 0; i < intervals; i++) {
+			float middle = 0.5f * (bounds[i] + bounds[i + 1]);
+			for (size_t z = 0; z < zones.size(); z++) {
+				if (zones[z].start <= middle && middle < zones[z].end) {
+					active.push_back(static_cast<uint32_t>(z));
+				}
+			}
+			offsets[i + 1] = static_cast<uint32_t>(active.size());
+		}
+	}
+
+	Active at(float s, Cursor& cursor) const
+	{
+		size_t intervals = offsets.size() > 0 ? offsets.size() - 1 : 0;
+		if (intervals == 0 || s < bounds.front() || s > bounds.back()) return {};
+
+		size_t& i = cursor.interval;
+		if (i >= intervals) i = 0;
+		if (!contains(i, s)) {
+			if (i + 1 < intervals && contains(i + 1, s)) i++;
+			else if (i > 0 && contains(i - 1, s)) i--;
+			else i = std::min(static_cast<size_t>(std::upper_bound(bounds.begin(), bounds.end(), s) - bounds.begin()), intervals) - 1;
+		}
+		return { active.data() + offsets[i], active.data() + offsets[i + 1] };
+	}
+
+	bool propels(float s, Cursor& cursor) const
+	{
+		for (uint32_t z : at(s, cursor)) {
+			if (zones[z].propels()) return true;
+		}
+		return false;
+	}
+
+	const TrackZone& operator[](uint32_t z) const
+	{
+		return zones[z];
+	}
+
+private:
+	std::vector<float>    bounds;  // sorted zone boundaries
+	std::vector<uint32_t> offsets; // the zones active in interval i are active[offsets[i]] to active[offsets[i + 1]]
+	std::vector<uint32_t> active;
+
+	bool contains(size_t i, float s) const
+	{
+		return bounds[i] <= s && (s < bounds[i + 1] || (i + 2 == bounds.size() && s == bounds[i + 1]));
+	}
+};
+
+} // namespace osp
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "constants.h"
+#include "slope_table.h"
+#include "track_zones.h"
+#include "train_model.h"
+
+namespace osp
+{
+
+// Integrates the motion of the train along the track as the system ds/dt = v, dv/dt = a(s, v), a being
+// gravity along the tangents under all cars, rolling friction, drag and the track's zones, with the slopes
+// looked up in the track's SlopeTable. Dormand-Prince 5(4) takes adaptive steps from the embedded error estimate and
+// answers for any time in between with cubic Hermite interpolation, so the caller can ask at a fixed rate
+// while the accelerations are only evaluated as often as the track's shape needs.
+// The fixed step trapezoid rule stays as reference.
+class TrainIntegrator
+{
+public:
+	enum class Method {
+		Trapezoid,
+		DormandPrince
+	};
+	static constexpr std::array<const char*, 2> METHOD_NAMES = { "Trapezoid", "Dormand-Prince" };
+
+	struct Parameters {
+		float rollingFriction = 0.001f;
+		float dragCoeff = 0.0f;     // per meter, drag deceleration is dragCoeff * v^2
+		TrainModel train;
+
+		Method method = Method::DormandPrince;
+		double fixedStep = 0.001; // seconds, Trapezoid
+		double tolerance = 1e-6;  // relative and absolute (m, m/s) local error per step, DormandPrince
+		double maxStep = 0.25;    // seconds
+		double minStep = 1e-3;    // seconds, taken whatever the error: a train rocking at the end of a lift would shrink steps without bound
+	};
+
+	struct Stats {
+		uint64_t steps = 0;       // accepted
+		uint64_t rejected = 0;
+		uint64_t evaluations = 0; // accelerations, each a slope lookup per car
+		double   lastError = 0.0; // estimated local position error of the last step, m
+		double   errorBound = 0.0; // sum of the local position error estimates, m
+	};
+
+	Parameters parameters;
+
+	// Restarts at s with speed v, forgetting the step size and the last step
+	void reset(double time, float s, float v)
+	{
+		t0 = t1 = time;
+		y0 = y1 = { s, v };
+		hasDerivative = false;
+		ended = false;
+		h = 0.0;
+		stats.lastError = 0.0;
+	}
+
+	// Starts counting for a new run
+	void resetStats()
+	{
+		stats = {};
+	}
+
+	// Integrates until time and interpolates the state there, slopes and zones have to stay the same until the next reset()
+	void advanceTo(const SlopeTable& slopes, const TrackZones& trackZones, double time)
+	{
+		totalLength = slopes.totalLength;
+		zones = &trackZones;
+		if (!hasDerivative) {
+			constrain(y1);
+			y0 = y1;
+			f1 = derivative(slopes, y1);
+			hasDerivative = true;
+		}
+
+		while (t1 < time && !atEnd()) {
+			if (parameters.method == Method::Trapezoid) {
+				stepTrapezoid(slopes);
+			}
+			else {
+				stepDormandPrince(slopes);
+			}
+		}
+		interpolate(std::min(time, t1));
+	}
+
+	float s() const { return static_cast<float>(current[0]); }
+	float v() const { return static_cast<float>(current[1]); }
+
+	bool atEnd() const
+	{
+		return ended;
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+private:
+	using Vec = std::array<double, 2>; // s, v
+
+	double t0 = 0.0, t1 = 0.0;
+	Vec    y0{}, y1{}, f0{}, f1{}; // the last step, from t0 to t1, with derivatives at both ends
+	Vec    current{};
+	bool   hasDerivative = false;
+	bool   ended = false;
+	double h = 0.0;
+	double totalLength = 0.0;
+	Stats  stats;
+
+	const TrackZones*  zones = nullptr;
+	TrackZones::Cursor cursor; // the steps move a little at a time, see TrackZones
+
+	Vec derivative(const SlopeTable& slopes, const Vec& y)
+	{
+		stats.evaluations++;
+		double s = y[0];
+		double v = y[1];
+
+		double a = parameters.train.gravityAlongTrack(slopes, static_cast<float>(std::clamp(s, 0.0, totalLength)));
+		if (v > 0.00001 || v < -0.00001) {
+			a -= parameters.rollingFriction * 9.81 * (v > 0.0 ? 1.0 : -1.0);
+		}
+		a -= parameters.dragCoeff * v * std::abs(v);
+
+		for (uint32_t z : zones->at(static_cast<float>(s), cursor)) {
+			a = (*zones)[z].accelerate(v, a);
+		}
+		return { v, a };
+	}
+
+	// Ends of the track and stopping brakes, applied to every accepted step. Zones that propel the train do
+	// so in derivative() only. Returns true when the state changed.
+	bool constrain(Vec& y)
+	{
+		Vec before = y;
+		if (y[0] < 0.0) y = { 0.0, 0.0 };
+		if (y[0] >= totalLength) {
+			y = { totalLength, 0.0 };
+			ended = true;
+		}
+		else {
+			for (uint32_t z : zones->at(static_cast<float>(y[0]), cursor)) {
+				y[1] = (*zones)[z].constrain(y[1]);
+			}
+		}
+		return y != before;
+	}
+
+	void accept(const SlopeTable& slopes, double t, const Vec& y, const Vec& f)
+	{
+		t0 = t1;
+		y0 = y1;
+		f0 = f1;
+		t1 = t;
+		y1 = y;
+		f1 = f;
+		if (constrain(y1)) {
+			f1 = derivative(slopes, y1);
+		}
+		stats.steps++;
+	}
+
+	void stepTrapezoid(const SlopeTable& slopes)
+	{
+		double dt = parameters.fixedStep;
+		Vec    y = { 0.0, y1[1] + f1[1] * dt };
+		y[0] = y1[0] + 0.5 * (y1[1] + y[1]) * dt;
+		accept(slopes, t1 + dt, y, derivative(slopes, y));
+	}
+
+	// One accepted step, retried with smaller sizes until the error estimate is within tolerance
+	void stepDormandPrince(const SlopeTable& slopes)
+	{
+		// a(s, v) does not depend on time, so the nodes c2..c7 are not needed
+		static constexpr double a21 = 1.0 / 5;
+		static constexpr double a31 = 3.0 / 40, a32 = 9.0 / 40;
+		static constexpr double a41 = 44.0 / 45, a42 = -56.0 / 15, a43 = 32.0 / 9;
+		static constexpr double a51 = 19372.0 / 6561, a52 = -25360.0 / 2187, a53 = 64448.0 / 6561, a54 = -212.0 / 729;
+		static constexpr double a61 = 9017.0 / 3168, a62 = -355.0 / 33, a63 = 46732.0 / 5247, a64 = 49.0 / 176, a65 = -5103.0 / 18656;
+		static constexpr double b1 = 35.0 / 384, b3 = 500.0 / 1113, b4 = 125.0 / 192, b5 = -2187.0 / 6784, b6 = 11.0 / 84;
+		// difference between the 5th and the embedded 4th order weights
+		static constexpr double e1 = 71.0 / 57600, e3 = -71.0 / 16695, e4 = 71.0 / 1920, e5 = -17253.0 / 339200, e6 = 22.0 / 525, e7 = -1.0 / 40;
+
+		if (h <= 0.0) {
+			// first step: small enough for the initial acceleration
+			double scale = std::abs(f1[1]) + parameters.tolerance;
+			h = std::min(parameters.maxStep, 0.01 * std::sqrt(std::max(std::abs(y1[1]), 1.0) / scale));
+		}
+
+		for (;;) {
+			double dt = std::min(h, parameters.maxStep);
+
+			auto at = [&](double w1, const Vec& k1, double w2 = 0, const Vec& k2 = {}, double w3 = 0, const Vec& k3 = {}, double w4 = 0, const Vec& k4 = {}, double w5 = 0, const Vec& k5 = {}) {
+				Vec y;
+				for (int i = 0; i < 2; i++) {
+					y[i] = y1[i] + dt * (w1 * k1[i] + w2 * k2[i] + w3 * k3[i] + w4 * k4[i] + w5 * k5[i]);
+				}
+				return y;
+			};
+
+			const Vec& k1 = f1;
+			Vec k2 = derivative(slopes, at(a21, k1));
+			Vec k3 = derivative(slopes, at(a31, k1, a32, k2));
+			Vec k4 = derivative(slopes, at(a41, k1, a42, k2, a43, k3));
+			Vec k5 = derivative(slopes, at(a51, k1, a52, k2, a53, k3, a54, k4));
+			Vec k6 = derivative(slopes, at(a61, k1, a62, k2, a63, k3, a64, k4, a65, k5));
+			Vec y = at(b1, k1, b3, k3, b4, k4, b5, k5, b6, k6);
+			Vec k7 = derivative(slopes, y); // first stage of the next step
+
+			double error = 0.0;
+			double positionError = 0.0;
+			for (int i = 0; i < 2; i++) {
+				double e = dt * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i]);
+				double scale = parameters.tolerance * (1.0 + std::max(std::abs(y1[i]), std::abs(y[i])));
+				error = std::max(error, std::abs(e) / scale);
+				if (i == 0) positionError = std::abs(e);
+			}
+
+			// grow at most 5x, shrink at most 5x per try
+			double factor = error > 0.0 ? std::clamp(0.9 * std::pow(error, -0.2), 0.2, 5.0) : 5.0;
+			if (error <= 1.0 || dt <= parameters.minStep) {
+				h = std::min(dt * factor, parameters.maxStep);
+				stats.lastError = positionError;
+				stats.errorBound += positionError;
+				accept(slopes, t1 + dt, y, k7);
+				return;
+			}
+			stats.rejected++;
+			h = std::max(dt * factor, parameters.minStep);
+		}
+	}
+
+	// Cubic Hermite between the ends of the last step, using the derivatives at both
+	void interpolate(double t)
+	{
+		double dt = t1 - t0;
+		if (dt <= 0.0 || t >= t1) {
+			current = y1;
+			return;
+		}
+		double x = (t - t0) / dt;
+		double h00 = (1.0 + 2.0 * x) * (1.0 - x) * (1.0 - x);
+		double h10 = x * (1.0 - x) * (1.0 - x);
+		double h01 = x * x * (3.0 - 2.0 * x);
+		double h11 = x * x * (x - 1.0);
+		for (int i = 0; i < 2; i++) {
+			current[i] = h00 * y0[i] + h10 * dt * f0[i] + h01 * y1[i] + h11 * dt * f1[i];
+		}
+		current[0] = std::clamp(current[0], 0.0, totalLength);
+	}
+};
+
+} // namespace osp
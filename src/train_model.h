@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "constants.h"
+#include "slope_table.h"
+#include "track.h"
+
+namespace osp
+{
+
+// Cars of equal mass coupled at fixed distances, the simulation's s is the front of the train and car i
+// is centered carOffset(i) behind it. Cars not yet on the track count with the slope at its start.
+struct TrainModel
+{
+	static constexpr uint32_t MAX_CARS = 16;
+
+	uint32_t carCount = 7; // 1 to MAX_CARS, editors clamp it
+	float    carLength = 2.4f; // coupling to coupling, meters
+
+	float length() const
+	{
+		return carCount * carLength;
+	}
+
+	float carOffset(uint32_t i) const
+	{
+		return (i + 0.5f) * carLength;
+	}
+
+	// Arc lengths of the car centers, front to back, clamped to the track. positions has room for MAX_CARS.
+	void carPositions(float s, float totalLength, float* positions) const
+	{
+		assert(carCount >= 1 && carCount <= MAX_CARS);
+		for (uint32_t i = 0; i < carCount; i++) {
+			positions[i] = std::clamp(s - carOffset(i), 0.0f, totalLength);
+		}
+	}
+
+	// Acceleration along the track from gravity on the whole train, the mean over its cars
+	float gravityAlongTrack(const SlopeTable& slopes, float s) const
+	{
+		std::array<float, MAX_CARS> positions;
+		carPositions(s, slopes.totalLength, positions.data());
+
+		float slope = 0.0f;
+		for (uint32_t i = 0; i < carCount; i++) {
+			slope += slopes.slopeAt(positions[i]);
+		}
+		return 9.81f * slope / carCount;
+	}
+
+	// Frame of every car, as Track::evaluateFrenet(), for drawing the train
+	void carPoses(Track& track, float s, glm::mat4* poses) const
+	{
+		std::array<float, MAX_CARS> positions;
+		carPositions(s, track.totalLength(), positions.data());
+		for (uint32_t i = 0; i < carCount; i++) {
+			poses[i] = track.evaluateFrenet(positions[i]);
+		}
+	}
+};
+
+} // namespace osp
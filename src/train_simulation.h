@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stop_token>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include "constants.h"
+#include "simulation_timeline.h"
+#include "spsc_slot.h"
+#include "track.h"
+#include "train_integrator.h"
+#include "triple_buffer.h"
+
+namespace osp
+{
+
+// Moves the train along a snapshot of the track on its own thread, with a clock ticking at a fixed STEP
+// independent of the frame rate. Every wake-up advances the TrainIntegrator to the ticks that are due in
+// real time and publishes the last two states, the render thread interpolates between them in sample().
+// Each run, from the last moveTo(), keeps checkpoints in a SimulationTimeline so seekTo() can jump to any
+// time of it, forward or back, without losing the train's speed.
+class TrainSimulation
+{
+public:
+	static constexpr double STEP = 0.001;    // seconds, 1 kHz
+	static constexpr int    MAX_CATCH_UP = 250; // ticks per wake-up, beyond that the simulation drops time instead of spiralling
+
+	struct State {
+		double   time = 0.0; // seconds on the simulation clock
+		double   runTime = 0.0; // seconds since the start of the run
+		float    s = 0.0f;
+		float    v = 0.0f;
+		bool     atEnd = false;
+		uint64_t command = 0; // last moveTo() or seekTo() applied, the train jumps when it changes
+		bool     waiting = false; // for the simulation to apply the last command, s is the one asked for
+	};
+
+	TrainSimulation()
+	{
+		thread = std::jthread([this](std::stop_token stop) { run(stop); });
+	}
+
+	TrainSimulation(const TrainSimulation&) = delete;
+	TrainSimulation& operator=(const TrainSimulation&) = delete;
+
+	// Render thread: the train continues on this snapshot of the track from where it is
+	void setTrack(std::unique_ptr<Track> snapshot)
+	{
+		tracks.publish(std::move(snapshot));
+	}
+
+	// Render thread: puts the train at s with speed v, starting a new run
+	void moveTo(float s, float v)
+	{
+		pending = State{ .s = s, .v = v, .command = ++lastCommand };
+		commands.publish(std::make_unique<Command>(Command{ pending, false }));
+	}
+
+	// Render thread: continues the run from where the train is at runTime. The train stays where it was
+	// last sampled until the simulation has replayed there.
+	void seekTo(double runTime)
+	{
+		pending = sampled;
+		pending.runTime = runTime;
+		pending.command = ++lastCommand;
+		commands.publish(std::make_unique<Command>(Command{ pending, true }));
+	}
+
+	void setRunning(bool value)
+	{
+		running.store(value, std::memory_order_relaxed);
+	}
+
+	void setMethod(TrainIntegrator::Method value)
+	{
+		method.store(value, std::memory_order_relaxed);
+	}
+
+	// Render thread: the state one step behind the newest one, interpolated at the current time. Until a
+	// moveTo() or seekTo() has been applied by the simulation, the position it asked for, waiting.
+	State sample()
+	{
+		const Published& published = states.read();
+		stats = published.stats;
+		recorded = published.recorded;
+		if (published.current.command < lastCommand) {
+			State state = pending;
+			state.waiting = true;
+			return state;
+		}
+
+		double renderTime = seconds(std::chrono::steady_clock::now()) - STEP;
+		double span = published.current.time - published.previous.time;
+		float  alpha = span > 0.0 ? static_cast<float>(std::clamp((renderTime - published.previous.time) / span, 0.0, 1.0)) : 1.0f;
+
+		State state = published.current;
+		state.runTime = glm::mix(published.previous.runTime, published.current.runTime, static_cast<double>(alpha));
+		state.s = glm::mix(published.previous.s, published.current.s, alpha);
+		state.v = glm::mix(published.previous.v, published.current.v, alpha);
+		sampled = state;
+		return state;
+	}
+
+	// The cars behind the simulated front, for placing them along the track
+	const TrainModel& train() const
+	{
+		return parameters.train;
+	}
+
+	// Integrator steps, acceleration evaluations and error as of the last sample()
+	const TrainIntegrator::Stats& integratorStats() const
+	{
+		return stats;
+	}
+
+	// Run time the timeline has checkpoints up to as of the last sample(), seeking beyond records more
+	double recordedTime() const
+	{
+		return recorded;
+	}
+
+private:
+	struct Published {
+		State previous;
+		State current;
+		TrainIntegrator::Stats stats;
+		double recorded = 0.0;
+	};
+
+	struct Command {
+		State state;
+		bool  seek; // to state.runTime, otherwise a new run from state.s and state.v
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	const TrainIntegrator::Parameters parameters{};
+	const Clock::time_point epoch = Clock::now();
+
+	// render thread only
+	State                  pending;
+	State                  sampled;
+	uint64_t               lastCommand = 0;
+	TrainIntegrator::Stats stats;
+	double                 recorded = 0.0;
+
+	SpscSlot<Track>          tracks;   // render thread -> simulation
+	SpscSlot<Command>        commands; // render thread -> simulation
+	TripleBuffer<Published>  states;   // simulation -> render thread
+	std::atomic<bool>        running{ true };
+	std::atomic<TrainIntegrator::Method> method{ TrainIntegrator::Method::DormandPrince };
+
+	// declared last so it is joined before the rest goes away
+	std::jthread thread;
+
+	double seconds(Clock::time_point t) const
+	{
+		return std::chrono::duration<double>(t - epoch).count();
+	}
+
+	void run(std::stop_token stop)
+	{
+		std::unique_ptr<Track> track;
+		TrainIntegrator        integrator;
+		TrainIntegrator        replay;  // for seeking, leaves the running integrator's stats alone
+		SimulationTimeline     timeline;
+		integrator.parameters = parameters;
+		replay.parameters = parameters;
+		State                  current;
+		State                  previous;
+		double                 clock = seconds(Clock::now());
+		double                 runStart = clock; // clock at run time 0
+
+		// continue from the current state, e.g. on another curve or with another method
+		auto restart = [&]() {
+			integrator.reset(clock, current.s, current.v);
+			previous = current;
+		};
+		// the checkpoints are only valid for the same track and method, the run starts over from here
+		auto newRun = [&]() {
+			timeline.start(current.s, current.v);
+			current.runTime = 0.0;
+			runStart = clock;
+		};
+
+		while (!stop.stop_requested()) {
+			if (std::unique_ptr<Track> snapshot = tracks.take()) {
+				track = std::move(snapshot);
+				track->curve->update();
+				track->updateSlopes();
+				newRun();
+				restart();
+			}
+			if (std::unique_ptr<Command> command = commands.take()) {
+				if (!command->seek) {
+					current = command->state;
+					newRun();
+					integrator.resetStats();
+				}
+				else if (track) {
+					SimulationTimeline::Checkpoint state = timeline.seek(replay, track->slopes, track->zones, command->state.runTime);
+					current = { .runTime = state.time, .s = state.s, .v = state.v, .atEnd = state.atEnd };
+					runStart = clock - current.runTime;
+				}
+				current.time = clock;
+				current.command = command->state.command;
+				restart();
+			}
+			if (TrainIntegrator::Method m = method.load(std::memory_order_relaxed); m != integrator.parameters.method) {
+				integrator.parameters.method = m;
+				replay.parameters.method = m;
+				newRun();
+				restart();
+			}
+
+			double now = seconds(Clock::now());
+			if (!track || !running.load(std::memory_order_relaxed)) {
+				// paused, the clock follows real time so there is no backlog once running again
+				runStart += now - clock;
+				clock = now;
+				current.time = clock;
+				restart();
+			}
+			else {
+				int due = 0;
+				while (clock + STEP <= now && due < MAX_CATCH_UP) {
+					clock += STEP;
+					due++;
+				}
+				if (due == MAX_CATCH_UP) {
+					runStart += now - clock;
+					clock = now;
+					restart();
+				}
+				else if (due > 0) {
+					integrator.advanceTo(track->slopes, track->zones, clock);
+					previous = current;
+					current.time = clock;
+					current.runTime = clock - runStart;
+					current.s = integrator.s();
+					current.v = integrator.v();
+					current.atEnd = integrator.atEnd();
+					timeline.record(current.runTime, current.s, current.v, current.atEnd);
+				}
+			}
+
+			states.back() = { previous, current, integrator.getStats(), timeline.recordedTime() };
+			states.publish();
+
+			std::this_thread::sleep_until(epoch + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(clock + STEP)));
+		}
+	}
+};
+
+} // namespace osp
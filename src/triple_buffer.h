@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace osp
+{
+
+// Passes a stream of values from one producer thread to one consumer thread without locks or allocation.
+// The producer fills back() and publishes it, the consumer reads the newest published value. Both sides
+// own one of the three buffers, the third is swapped between them with a single atomic exchange.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Producer side: the buffer to write next
+	T& back()
+	{
+		return buffers[backIndex];
+	}
+
+	// Producer side: hands back() to the consumer and continues with the buffer it gave up
+	void publish()
+	{
+		backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Consumer side: the newest published value, the same as last time when nothing new was published
+	const T& read()
+	{
+		if (middle.load(std::memory_order_relaxed) & FRESH) {
+			frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+		}
+		return buffers[frontIndex];
+	}
+
+private:
+	static constexpr uint8_t INDEX = 0x3;
+	static constexpr uint8_t FRESH = 0x4;
+
+	std::array<T, 3>     buffers{};
+	uint8_t              backIndex = 0;  // producer only
+	uint8_t              frontIndex = 1; // consumer only
+	std::atomic<uint8_t> middle{ 2 };
+};
+
+} // namespace osp
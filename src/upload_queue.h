@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#if defined(__INTELLISENSE__) || !defined(USE_CPP20_MODULES)
+#	include <vulkan/vulkan_raii.hpp>
+#else
+import vulkan_hpp;
+#endif
+
+#include "gpu_buffer.h"
+#include "vk_context.h"
+
+namespace osp
+{
+
+// Streams buffer contents to the GPU through a persistently mapped staging ring without waiting for the
+// queue. Copies are recorded into batches that submit() hands to the queue with a fence. Each batch starts
+// with a barrier after the vertex stages of everything submitted before it, so buffers still drawn by
+// frames in flight can be rewritten, and ends with one that makes the copies visible to everything
+// submitted after it, so the next frame can draw from them right away. The fences only tell when ring
+// space can be reused. Only a ring too full for the next copy waits, for the oldest batch.
+class UploadQueue
+{
+public:
+	static constexpr vk::DeviceSize ALIGNMENT = 16;
+
+	UploadQueue() = default;
+	UploadQueue(const UploadQueue&) = delete;
+	UploadQueue& operator=(const UploadQueue&) = delete;
+
+	void init(VkContext& vkContext, vk::raii::CommandPool& pool, vk::DeviceSize ringSize = vk::DeviceSize(32) << 20)
+	{
+		context = &vkContext;
+		commandPool = &pool;
+		capacity = ringSize;
+		ring.create(vkContext, capacity, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+		mapped = static_cast<std::byte*>(ring.bufferMemory.mapMemory(0, capacity));
+	}
+
+	// Creates a device local buffer in target and queues its contents
+	void upload(GpuBuffer& target, size_t size, vk::BufferUsageFlags usage, const void* data)
+	{
+		if (size == 0) return;
+		target.create(*context, size, usage | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal);
+		update(target, size, data);
+	}
+
+	// Queues new contents for a buffer created by upload()
+	void update(GpuBuffer& target, size_t size, const void* data)
+	{
+		if (size == 0) return;
+
+		if (size > capacity) {
+			// too large for the ring, staged in a buffer of its own that lives as long as the batch
+			GpuBuffer staging(*context, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+			void* stagingData = staging.bufferMemory.mapMemory(0, size);
+			memcpy(stagingData, data, size);
+			staging.bufferMemory.unmapMemory();
+
+			Batch& batch = openBatch();
+			batch.cmd.copyBuffer(*staging.buffer, *target.buffer, vk::BufferCopy{ .size = size });
+			batch.oversized.push_back(std::move(staging));
+			return;
+		}
+
+		vk::DeviceSize held = 0;
+		vk::DeviceSize offset = allocate(size, held);
+		memcpy(mapped + offset, data, size);
+
+		Batch& batch = openBatch();
+		batch.cmd.copyBuffer(*ring.buffer, *target.buffer, vk::BufferCopy{ .srcOffset = offset, .size = size });
+		batch.bytes += held;
+		batch.end = head;
+	}
+
+	// Hands the copies queued since the last submit to the queue
+	void submit()
+	{
+		if (!open) return;
+
+		vk::MemoryBarrier visible{
+			.srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+			.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead };
+		open->cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader, {}, visible, {}, {});
+		open->cmd.end();
+
+		context->device.resetFences(*open->fence);
+		context->queue.submit(vk::SubmitInfo{ .commandBufferCount = 1, .pCommandBuffers = &*open->cmd }, *open->fence);
+		inFlight.push_back(std::move(*open));
+		open.reset();
+	}
+
+	// Releases the ring space of finished batches
+	void collect()
+	{
+		while (!inFlight.empty() && context->device.waitForFences(*inFlight.front().fence, vk::True, 0) == vk::Result::eSuccess) {
+			release();
+		}
+	}
+
+	size_t batchesInFlight() const
+	{
+		return inFlight.size();
+	}
+
+private:
+	struct Batch {
+		vk::raii::CommandBuffer cmd = nullptr;
+		vk::raii::Fence         fence = nullptr;
+		vk::DeviceSize          end = 0;   // ring head after the batch's last copy
+		vk::DeviceSize          bytes = 0; // ring bytes held, including space skipped at the wrap
+		std::vector<GpuBuffer>  oversized;
+	};
+
+	VkContext*             context = nullptr;
+	vk::raii::CommandPool* commandPool = nullptr;
+
+	GpuBuffer      ring;
+	std::byte*     mapped = nullptr;
+	vk::DeviceSize capacity = 0;
+	vk::DeviceSize head = 0; // next free byte
+	vk::DeviceSize tail = 0; // oldest byte still read by a batch
+	vk::DeviceSize used = 0;
+
+	std::optional<Batch> open;
+	std::deque<Batch>    inFlight; // in submission order, which is also the order they finish in
+	std::vector<Batch>   spare;    // finished, their command buffers and fences are reused
+
+	Batch& openBatch()
+	{
+		if (open) return *open;
+
+		if (!spare.empty()) {
+			open = std::move(spare.back());
+			spare.pop_back();
+		}
+		else {
+			open.emplace();
+			vk::CommandBufferAllocateInfo allocInfo{ .commandPool = **commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 1 };
+			open->cmd = std::move(context->device.allocateCommandBuffers(allocInfo).front());
+			open->fence = vk::raii::Fence(context->device, vk::FenceCreateInfo{});
+		}
+		open->cmd.begin(vk::CommandBufferBeginInfo{ .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+		open->cmd.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {});
+		return *open;
+	}
+
+	// Offset of size free bytes in the ring, held returns what they take up including a skipped end
+	vk::DeviceSize allocate(vk::DeviceSize size, vk::DeviceSize& held)
+	{
+		size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		for (;;) {
+			collect();
+			if (used == 0) head = tail = 0;
+
+			// the used part is [tail, head), or wraps around the end when head is before tail
+			if (used == 0 || head > tail) {
+				if (capacity - head >= size) {
+					held = size;
+					return take(head, size, held);
+				}
+				if (tail >= size) {
+					held = capacity - head + size;
+					return take(0, size, held);
+				}
+			}
+			else if (tail - head >= size) {
+				held = size;
+				return take(head, size, held);
+			}
+
+			// full, the open batch holds ring space as well
+			submit();
+			while (vk::Result::eTimeout == context->device.waitForFences(*inFlight.front().fence, vk::True, UINT64_MAX));
+			release();
+		}
+	}
+
+	vk::DeviceSize take(vk::DeviceSize offset, vk::DeviceSize size, vk::DeviceSize held)
+	{
+		used += held;
+		head = offset + size;
+		return offset;
+	}
+
+	void release()
+	{
+		Batch& batch = inFlight.front();
+		if (batch.bytes > 0) {
+			used -= batch.bytes;
+			tail = batch.end;
+		}
+		batch.bytes = 0;
+		batch.oversized.clear();
+		batch.cmd.reset();
+		spare.push_back(std::move(batch));
+		inFlight.pop_front();
+	}
+};
+
+} // namespace osp
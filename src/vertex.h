@@ -2,6 +2,9 @@
 
 #include <vulkan/vulkan_raii.hpp>
 
+#include <array>
+#include <cstdint>
+
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
@@ -35,6 +38,107 @@ struct Vertex
 	}
 };
 
+// Compact 16 byte vertex used for track geometry. Positions are stored relative to the origin of the
+// chunk they belong to and scaled by its extent, the colour is a per-draw constant (see TrackMesh::DrawConstants).
+struct TrackVertex
+{
+	int16_t  pos[4];      // snorm, (pos - origin) / extent, w unused
+	int16_t  normal[2];   // snorm, octahedral encoded
+	uint16_t texCoord[2]; // unorm
+
+	static vk::VertexInputBindingDescription getBindingDescription()
+	{
+		return { 0, sizeof(TrackVertex), vk::VertexInputRate::eVertex };
+	}
+
+	static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescriptions()
+	{
+		return {
+			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR16G16B16A16Snorm, offsetof(TrackVertex, pos)),
+			vk::VertexInputAttributeDescription(1, 0, vk::Format::eR16G16Snorm, offsetof(TrackVertex, normal)),
+			vk::VertexInputAttributeDescription(2, 0, vk::Format::eR16G16Unorm, offsetof(TrackVertex, texCoord)) };
+	}
+
+	static int16_t quantizeSnorm(float v)
+	{
+		return static_cast<int16_t>(glm::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+	}
+
+	static uint16_t quantizeUnorm(float v)
+	{
+		return static_cast<uint16_t>(glm::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f));
+	}
+
+	// Maps a unit vector onto the octahedron and unfolds it into the [-1, 1] square
+	static glm::vec2 octEncode(glm::vec3 n)
+	{
+		n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f) {
+			glm::vec2 signNotZero(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+			e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * signNotZero;
+		}
+		return e;
+	}
+
+	static glm::vec3 octDecode(glm::vec2 e)
+	{
+		glm::vec3 n(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+		float t = glm::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+
+	// origin.xyz is the chunk origin, origin.w its extent
+	static TrackVertex encode(glm::vec3 pos, glm::vec3 normal, glm::vec2 texCoord, glm::vec4 origin)
+	{
+		glm::vec3 local = (pos - glm::vec3(origin)) / origin.w;
+		glm::vec2 oct = octEncode(normal);
+
+		TrackVertex vertex;
+		vertex.pos[0] = quantizeSnorm(local.x);
+		vertex.pos[1] = quantizeSnorm(local.y);
+		vertex.pos[2] = quantizeSnorm(local.z);
+		vertex.pos[3] = 0;
+		vertex.normal[0] = quantizeSnorm(oct.x);
+		vertex.normal[1] = quantizeSnorm(oct.y);
+		vertex.texCoord[0] = quantizeUnorm(texCoord.x);
+		vertex.texCoord[1] = quantizeUnorm(texCoord.y);
+		return vertex;
+	}
+
+	glm::vec3 decodePosition(glm::vec4 origin) const
+	{
+		return glm::vec3(origin) + origin.w * glm::vec3(pos[0], pos[1], pos[2]) / 32767.0f;
+	}
+
+	glm::vec3 decodeNormal() const
+	{
+		return octDecode(glm::vec2(normal[0], normal[1]) / 32767.0f);
+	}
+};
+static_assert(sizeof(TrackVertex) == 16);
+
+// Second vertex stream of the track, kept apart from the geometry so recolouring only rewrites this small
+// buffer. A colour with zero alpha leaves the vertex in the draw colour.
+struct TrackVertexAttributes
+{
+	uint8_t color[4]; // unorm, rgb + blend weight over the draw colour
+
+	static vk::VertexInputBindingDescription getBindingDescription()
+	{
+		return { 1, sizeof(TrackVertexAttributes), vk::VertexInputRate::eVertex };
+	}
+
+	static std::array<vk::VertexInputAttributeDescription, 1> getAttributeDescriptions()
+	{
+		return {
+			vk::VertexInputAttributeDescription(3, 1, vk::Format::eR8G8B8A8Unorm, offsetof(TrackVertexAttributes, color)) };
+	}
+};
+static_assert(sizeof(TrackVertexAttributes) == 4);
+
 
 } // namespace osp
 
@@ -231,7 +231,7 @@ struct VkContext
 
 		// query for Vulkan 1.3 features
 		vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features, vk::PhysicalDeviceVulkan13Features, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT> featureChain = {
-			{.features = {.fillModeNonSolid = true, .wideLines = true, .samplerAnisotropy = true}},        // vk::PhysicalDeviceFeatures2
+			{.features = {.samplerAnisotropy = true}},                   // vk::PhysicalDeviceFeatures2
 			{.shaderDrawParameters = true},                                                        // vk::PhysicalDeviceVulkan11Features
 			{.synchronization2 = true, .dynamicRendering = true},        // vk::PhysicalDeviceVulkan13Features
 			{.extendedDynamicState = true}                               // vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT
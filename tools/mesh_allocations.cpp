@@ -0,0 +1,145 @@
+// Counts the heap allocations of track mesh rebuilds by replacing the global operator new. Every track is
+// rebuilt a few times, first with a new LinearArena for each rebuild and then with one arena kept across
+// rebuilds, the way TrackMeshWorker and TrackMeshBuilder keep theirs. Allocations still held after a
+// rebuild belong to the mesh it produced (or to a grown arena), the others were temporaries.
+//
+//   OspreyMeshAllocations [--rebuilds n] [track.yaml | directory]...
+//
+// Without tracks every tracks/*.yaml is rebuilt.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "linear_arena.h"
+#include "track.h"
+#include "track_mesh.h"
+
+namespace
+{
+
+std::atomic<size_t> heapAllocations{ 0 };
+std::atomic<size_t> heapFrees{ 0 };
+
+struct Count
+{
+	size_t allocations = 0; // during the rebuild
+	size_t held = 0;        // of those, still allocated after it
+
+	static Count since(size_t allocations, size_t frees)
+	{
+		size_t nowAllocations = heapAllocations.load();
+		size_t nowFrees = heapFrees.load();
+		return { nowAllocations - allocations, (nowAllocations - nowFrees) - (allocations - frees) };
+	}
+};
+
+// Heap allocations of one rebuild, arena is nullptr for a new arena each time
+Count rebuild(osp::Track& track, osp::LinearArena* arena)
+{
+	osp::TrackMesh mesh;
+	mesh.track = &track;
+
+	size_t allocations = heapAllocations.load();
+	size_t frees = heapFrees.load();
+	mesh.generateMesh({}, arena);
+	return Count::since(allocations, frees);
+}
+
+void printCount(const char* label, const Count& count)
+{
+	std::cout << "  " << label << count.allocations << " allocations, " << count.held << " still held, "
+		<< count.allocations - count.held << " temporary\n";
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size > 0 ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	if (!p) return;
+	heapFrees.fetch_add(1, std::memory_order_relaxed);
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	::operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	::operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	::operator delete(p);
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		int rebuilds = 3;
+		std::vector<std::filesystem::path> inputs;
+		for (int i = 1; i < argc; i++) {
+			std::string argument = argv[i];
+			if (argument == "--rebuilds" && i + 1 < argc) rebuilds = std::max(1, std::stoi(argv[++i]));
+			else if (argument.starts_with("--")) throw std::invalid_argument("usage: OspreyMeshAllocations [--rebuilds n] [track.yaml | directory]...");
+			else inputs.emplace_back(argument);
+		}
+		if (inputs.empty()) inputs.emplace_back("tracks");
+
+		std::vector<std::filesystem::path> paths;
+		for (const auto& input : inputs) {
+			if (!std::filesystem::is_directory(input)) {
+				paths.push_back(input);
+				continue;
+			}
+			for (const auto& entry : std::filesystem::directory_iterator(input)) {
+				if (entry.path().extension() == ".yaml") paths.push_back(entry.path());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+
+		for (const auto& path : paths) {
+			osp::Track track;
+			track.load(path.string());
+			track.update();
+			std::cout << path.filename().string() << ", " << track.curve->getNumSegments() << " segments, "
+				<< track.totalLength() << " m\n";
+
+			printCount("new arena:      ", rebuild(track, nullptr));
+
+			// the first rebuild grows the arena, the later ones show the steady state
+			osp::LinearArena arena;
+			for (int r = 0; r < rebuilds; r++) {
+				printCount(r == 0 ? "reused, first:  " : "reused, later:  ", rebuild(track, &arena));
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,342 @@
+// Headless parameter sweep: simulates the train on a set of tracks over a grid of rolling friction, drag
+// and lift and launch speed, on all cores and as fast as the integrator goes, and writes summaries and speed
+// profiles as CSV. Built from the simulation headers only, it links neither GLFW nor Vulkan.
+// With --trains it also runs the dispatch simulation for the hourly capacity of each track.
+//
+//   OspreySweep [options] [track.yaml | directory]...
+//
+// Without tracks every tracks/*.yaml is swept.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dispatch_simulation.h"
+#include "track.h"
+#include "train_integrator.h"
+
+namespace
+{
+
+// A single value "a" or n evenly spaced values "a:b:n"
+struct Range
+{
+	double from = 0.0;
+	double to = 0.0;
+	int    count = 1;
+
+	static Range parse(const std::string& text)
+	{
+		Range range;
+		std::stringstream stream(text);
+		std::string       part;
+		std::vector<std::string> parts;
+		while (std::getline(stream, part, ':')) {
+			parts.push_back(part);
+		}
+		if (parts.size() == 1) {
+			range.from = range.to = std::stod(parts[0]);
+		}
+		else if (parts.size() == 3) {
+			range.from = std::stod(parts[0]);
+			range.to = std::stod(parts[1]);
+			range.count = std::stoi(parts[2]);
+		}
+		if ((parts.size() != 1 && parts.size() != 3) || range.count < 1) {
+			throw std::invalid_argument("expected a value or from:to:count, got " + text);
+		}
+		return range;
+	}
+
+	double at(int i) const
+	{
+		return count > 1 ? from + (to - from) * i / (count - 1) : from;
+	}
+};
+
+struct Options
+{
+	Range       rollingFriction{ 0.001, 0.001, 1 };
+	Range       dragCoeff{ 0.0, 0.0, 1 };
+	Range       launchSpeed{ -1.0, -1.0, 1 }; // speed of every lift and launch zone, < 0 keeps the track's
+	double      duration = 600.0;       // simulated seconds before a run is given up
+	double      sampleInterval = 0.1;   // seconds between profile rows, 0 writes no profiles
+	double      tolerance = 1e-6;
+	Range       trainCount{ 0.0, 0.0, 1 }; // trains on the circuit, 0 runs no dispatch simulation
+	Range       dwell{ 30.0, 30.0, 1 };
+	unsigned    threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string output = "sweep";       // writes <output>_summary.csv and <output>_profiles.csv
+	std::vector<std::filesystem::path> tracks;
+};
+
+struct Run
+{
+	size_t track;
+	float  rollingFriction;
+	float  dragCoeff;
+	float  launchSpeed; // < 0 for the track's own
+};
+
+struct Result
+{
+	bool     completed = false; // reached the end of the track
+	bool     stalled = false;   // stopped outside lifts and launches
+	double   time = 0.0;
+	float    endS = 0.0f;
+	float    maxS = 0.0f;
+	float    maxSpeed = 0.0f;
+	osp::TrainIntegrator::Stats stats;
+	std::string profile; // CSV rows
+};
+
+void printUsage()
+{
+	std::cerr <<
+		"usage: OspreySweep [options] [track.yaml | directory]...\n"
+		"  --friction a[:b:n]     rolling friction coefficient (0.001)\n"
+		"  --drag a[:b:n]         drag coefficient per meter (0)\n"
+		"  --launch a[:b:n]       speed of lifts and launches in m/s (the track's zones)\n"
+		"  --duration s           simulated time before a run is given up (600)\n"
+		"  --sample s             profile interval, 0 for no profiles (0.1)\n"
+		"  --tolerance e          integrator error tolerance (1e-6)\n"
+		"  --trains a[:b:n]       trains for the capacity, writes prefix_capacity.csv (none)\n"
+		"  --dwell a[:b:n]        station dwell per train in s (30)\n"
+		"  --threads n            worker threads (all cores)\n"
+		"  --output prefix        writes prefix_summary.csv and prefix_profiles.csv (sweep)\n";
+}
+
+Options parseOptions(int argc, char** argv)
+{
+	Options options;
+	std::vector<std::filesystem::path> inputs;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		auto value = [&]() -> std::string {
+			if (i + 1 >= argc) throw std::invalid_argument(argument + " needs a value");
+			return argv[++i];
+		};
+
+		if (argument == "--friction") options.rollingFriction = Range::parse(value());
+		else if (argument == "--drag") options.dragCoeff = Range::parse(value());
+		else if (argument == "--launch") options.launchSpeed = Range::parse(value());
+		else if (argument == "--duration") options.duration = std::stod(value());
+		else if (argument == "--sample") options.sampleInterval = std::stod(value());
+		else if (argument == "--tolerance") options.tolerance = std::stod(value());
+		else if (argument == "--trains") options.trainCount = Range::parse(value());
+		else if (argument == "--dwell") options.dwell = Range::parse(value());
+		else if (argument == "--threads") options.threads = std::max(1, std::stoi(value()));
+		else if (argument == "--output") options.output = value();
+		else if (argument == "--help" || argument == "-h") {
+			printUsage();
+			std::exit(EXIT_SUCCESS);
+		}
+		else if (argument.starts_with("--")) throw std::invalid_argument("unknown option " + argument);
+		else inputs.emplace_back(argument);
+	}
+	if (inputs.empty()) {
+		inputs.emplace_back("tracks");
+	}
+
+	for (const std::filesystem::path& input : inputs) {
+		if (std::filesystem::is_directory(input)) {
+			std::vector<std::filesystem::path> found;
+			for (const auto& entry : std::filesystem::directory_iterator(input)) {
+				if (entry.is_regular_file() && entry.path().extension() == ".yaml") found.push_back(entry.path());
+			}
+			std::sort(found.begin(), found.end());
+			options.tracks.insert(options.tracks.end(), found.begin(), found.end());
+		}
+		else {
+			options.tracks.push_back(input);
+		}
+	}
+	if (options.tracks.empty()) {
+		throw std::invalid_argument("no tracks found");
+	}
+	return options;
+}
+
+// From the start at rest until the end of the track, a stop outside lifts and launches, or the duration
+Result simulate(osp::Track& track, const Run& run, size_t index, const Options& options)
+{
+	osp::TrackZones zones = track.zones;
+	if (run.launchSpeed >= 0.0f) {
+		for (osp::TrackZone& zone : zones.zones) {
+			if (zone.propels()) zone.speed = run.launchSpeed;
+		}
+		zones.build();
+	}
+	osp::TrackZones::Cursor cursor;
+
+	osp::TrainIntegrator integrator;
+	integrator.parameters.rollingFriction = run.rollingFriction;
+	integrator.parameters.dragCoeff = run.dragCoeff;
+	integrator.parameters.tolerance = options.tolerance;
+	integrator.reset(0.0, 0.0f, 0.0f);
+
+	Result             result;
+	std::ostringstream profile;
+	double             interval = options.sampleInterval > 0.0 ? options.sampleInterval : 0.1;
+
+	for (int i = 1; result.time < options.duration; i++) {
+		result.time = i * interval;
+		integrator.advanceTo(track.slopes, zones, result.time);
+		float s = integrator.s();
+		float v = integrator.v();
+
+		result.endS = s;
+		result.maxS = std::max(result.maxS, s);
+		result.maxSpeed = std::max(result.maxSpeed, std::abs(v));
+		if (options.sampleInterval > 0.0) {
+			profile << index << ',' << result.time << ',' << s << ',' << v << ',' << track.evaluatePosition(s).y << '\n';
+		}
+
+		if (integrator.atEnd()) {
+			result.completed = true;
+			break;
+		}
+		if (v <= 0.0f && !zones.propels(s, cursor)) {
+			result.stalled = true;
+			break;
+		}
+	}
+	result.stats = integrator.getStats();
+	result.profile = profile.str();
+	return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		Options options = parseOptions(argc, argv);
+
+		std::vector<osp::Track> tracks(options.tracks.size());
+		for (size_t i = 0; i < tracks.size(); i++) {
+			tracks[i].load(options.tracks[i].string());
+			tracks[i].updateSlopes();
+		}
+
+		std::vector<Run> runs;
+		for (size_t t = 0; t < tracks.size(); t++) {
+			for (int f = 0; f < options.rollingFriction.count; f++) {
+				for (int d = 0; d < options.dragCoeff.count; d++) {
+					for (int l = 0; l < options.launchSpeed.count; l++) {
+						runs.push_back({ t, (float)options.rollingFriction.at(f), (float)options.dragCoeff.at(d), (float)options.launchSpeed.at(l) });
+					}
+				}
+			}
+		}
+
+		// Runs differ a lot in length, so the workers take them one at a time instead of in fixed blocks,
+		// each on its own copies of the tracks
+		std::vector<Result> results(runs.size());
+		std::atomic<size_t> next{ 0 };
+		auto start = std::chrono::steady_clock::now();
+		{
+			std::vector<std::jthread> workers;
+			for (unsigned w = 0; w < std::min<size_t>(options.threads, runs.size()); w++) {
+				workers.emplace_back([&]() {
+					std::vector<std::unique_ptr<osp::Track>> copies(tracks.size());
+					for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < runs.size();) {
+						std::unique_ptr<osp::Track>& track = copies[runs[i].track];
+						if (!track) {
+							track = std::make_unique<osp::Track>(tracks[runs[i].track]);
+						}
+						results[i] = simulate(*track, runs[i], i, options);
+					}
+				});
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::ofstream summary(options.output + "_summary.csv");
+		summary << "run,track,rolling_friction,drag_coeff,launch_speed,completed,stalled,time,end_s,max_s,max_speed,mean_speed,steps,rejected,evaluations,error_bound\n";
+		double simulated = 0.0;
+		for (size_t i = 0; i < runs.size(); i++) {
+			const Run&    run = runs[i];
+			const Result& result = results[i];
+			summary << i << ',' << options.tracks[run.track].stem().string() << ',' << run.rollingFriction << ',' << run.dragCoeff << ',';
+			if (run.launchSpeed >= 0.0f) summary << run.launchSpeed;
+			summary << ',' << result.completed << ',' << result.stalled << ',' << result.time << ',' << result.endS << ',' << result.maxS << ','
+				<< result.maxSpeed << ',' << (result.time > 0.0 ? result.endS / result.time : 0.0) << ','
+				<< result.stats.steps << ',' << result.stats.rejected << ',' << result.stats.evaluations << ',' << result.stats.errorBound << '\n';
+			simulated += result.time;
+		}
+
+		if (options.sampleInterval > 0.0) {
+			std::ofstream profiles(options.output + "_profiles.csv");
+			profiles << "run,t,s,v,height\n";
+			for (const Result& result : results) {
+				profiles << result.profile;
+			}
+		}
+
+		std::cerr << runs.size() << " runs on " << tracks.size() << " tracks in " << seconds << " s, "
+			<< simulated / std::max(seconds, 1e-9) << "x real time, " << options.threads << " threads\n";
+
+		if (options.trainCount.from >= 1.0) {
+			std::vector<osp::DispatchSimulation::Settings> settings;
+			for (int n = 0; n < options.trainCount.count; n++) {
+				for (int w = 0; w < options.dwell.count; w++) {
+					for (int f = 0; f < options.rollingFriction.count; f++) {
+						for (int d = 0; d < options.dragCoeff.count; d++) {
+							osp::DispatchSimulation::Settings run;
+							run.trainCount = static_cast<uint32_t>(std::lround(options.trainCount.at(n)));
+							run.dwell = static_cast<float>(options.dwell.at(w));
+							run.duration = options.duration;
+							run.physics.rollingFriction = static_cast<float>(options.rollingFriction.at(f));
+							run.physics.dragCoeff = static_cast<float>(options.dragCoeff.at(d));
+							settings.push_back(run);
+						}
+					}
+				}
+			}
+
+			std::ofstream capacity(options.output + "_capacity.csv");
+			capacity << "track,trains,dwell,rolling_friction,drag_coeff,riders_per_hour,dispatches,stuck,stuck_s,dispatch_delay,stacked,stacked_seconds,block_stops,block_overruns,max_utilization\n";
+			auto start = std::chrono::steady_clock::now();
+			for (size_t t = 0; t < tracks.size(); t++) {
+				std::vector<osp::DispatchSimulation::Report> reports = osp::DispatchSimulation::runBatch(tracks[t], settings);
+				for (size_t i = 0; i < reports.size(); i++) {
+					const osp::DispatchSimulation::Settings& run = settings[i];
+					const osp::DispatchSimulation::Report&   report = reports[i];
+					uint32_t stops = 0, overruns = 0;
+					double   utilization = 0.0;
+					for (const osp::DispatchSimulation::Block& block : report.blocks) {
+						stops += block.stops;
+						overruns += block.overruns;
+						utilization = std::max(utilization, report.utilization(block));
+					}
+					capacity << options.tracks[t].stem().string() << ',' << run.trainCount << ',' << run.dwell << ',' << run.physics.rollingFriction << ',' << run.physics.dragCoeff << ','
+						<< report.ridersPerHour << ',' << report.dispatches << ',' << report.stuck << ',' << report.stuckS << ',' << report.dispatchDelay << ','
+						<< report.stacked << ',' << report.stackedSeconds << ',' << stops << ',' << overruns << ',' << utilization << '\n';
+				}
+			}
+			double capacitySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cerr << settings.size() * tracks.size() << " capacity runs in " << capacitySeconds << " s\n";
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}